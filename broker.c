@@ -0,0 +1,280 @@
+/* broker.c - Framing between pam_tacplus and the tacplusd broker.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <sys/un.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+
+#include "libtac.h"
+#include "broker.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static int _tacd_now_msecs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Reads exactly len bytes within *timeleft milliseconds */
+static int _tacd_readn(int fd, void *buf, size_t len, int *timeleft) {
+    struct pollfd pfd;
+    size_t done = 0;
+    ssize_t r;
+    int start;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (done < len) {
+        start = _tacd_now_msecs();
+        r = poll(&pfd, 1, *timeleft);
+        *timeleft -= _tacd_now_msecs() - start;
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0 || *timeleft < 0)
+            return -1;
+
+        r = read(fd, (char *) buf + done, len - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        done += r;
+    }
+    return 0;
+}
+
+static int _tacd_writen(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    ssize_t w;
+
+    while (done < len) {
+        /* a broker going away must not kill the calling process */
+        w = send(fd, (const char *) buf + done, len - done, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        done += w;
+    }
+    return 0;
+}
+
+/* Sends msg in one write.
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : the message is too long or the peer went away
+ */
+int tacd_write_msg(int fd, struct tacd_msg *msg) {
+    struct tacd_hdr *hdr;
+    u_char *buf, *p;
+    size_t len = 0;
+    u_int16_t slen;
+    int i, ret;
+
+    for (i = 0; i < msg->argc; i++) {
+        if (strlen(msg->argv[i]) > 0xffff)
+            return -1;
+        len += 2 + strlen(msg->argv[i]);
+    }
+    if (len > TACD_MAX_LENGTH)
+        return -1;
+
+    buf = (u_char *) xcalloc(1, TACD_HDR_SIZE + len);
+    hdr = (struct tacd_hdr *) buf;
+    hdr->version = TACD_VERSION;
+    hdr->op = msg->op;
+    hdr->argc = htons(msg->argc);
+    hdr->arg = htonl(msg->arg);
+    hdr->length = htonl(len);
+
+    p = buf + TACD_HDR_SIZE;
+    for (i = 0; i < msg->argc; i++) {
+        slen = strlen(msg->argv[i]);
+        *p++ = slen >> 8;
+        *p++ = slen & 0xff;
+        bcopy(msg->argv[i], p, slen);
+        p += slen;
+    }
+
+    ret = _tacd_writen(fd, buf, TACD_HDR_SIZE + len);
+    bzero(buf, TACD_HDR_SIZE + len);
+    free(buf);
+    return ret;
+}    /* tacd_write_msg */
+
+/* Receives a message, waiting at most timeout milliseconds for it.
+ * msg->argv must be released with tacd_free_msg().
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : timeout, peer went away or malformed message
+ */
+int tacd_read_msg(int fd, struct tacd_msg *msg, int timeout) {
+    struct tacd_hdr hdr;
+    u_char *buf, *p, *end;
+    u_int32_t len;
+    int i, slen;
+
+    bzero(msg, sizeof(struct tacd_msg));
+
+    if (_tacd_readn(fd, &hdr, TACD_HDR_SIZE, &timeout) < 0)
+        return -1;
+
+    len = ntohl(hdr.length);
+    if (hdr.version != TACD_VERSION || len > TACD_MAX_LENGTH
+        || ntohs(hdr.argc) * 2 > len) {
+        TACSYSLOG((LOG_ERR, "%s: malformed broker message", __FUNCTION__))
+        return -1;
+    }
+
+    buf = (u_char *) xcalloc(1, len + 1);
+    if (_tacd_readn(fd, buf, len, &timeout) < 0) {
+        free(buf);
+        return -1;
+    }
+
+    msg->op = hdr.op;
+    msg->arg = (int32_t) ntohl(hdr.arg);
+    msg->argv = (char **) xcalloc(ntohs(hdr.argc) + 1, sizeof(char *));
+
+    p = buf;
+    end = buf + len;
+    for (i = 0; i < ntohs(hdr.argc); i++) {
+        if (end - p < 2)
+            break;
+        slen = (p[0] << 8) | p[1];
+        p += 2;
+        if (end - p < slen)
+            break;
+        msg->argv[i] = (char *) xcalloc(1, slen + 1);
+        bcopy(p, msg->argv[i], slen);
+        msg->argc++;
+        p += slen;
+    }
+
+    bzero(buf, len);
+    free(buf);
+
+    if (msg->argc != ntohs(hdr.argc) || p != end) {
+        TACSYSLOG((LOG_ERR, "%s: malformed broker message", __FUNCTION__))
+        tacd_free_msg(msg);
+        return -1;
+    }
+    return 0;
+}    /* tacd_read_msg */
+
+/* Appends a copy of s to the strings of msg */
+void tacd_add_arg(struct tacd_msg *msg, const char *s) {
+    msg->argv = (char **) xrealloc(msg->argv,
+        (msg->argc + 2) * sizeof(char *));
+    if (s == NULL)
+        s = "";
+    msg->argv[msg->argc] = (char *) xcalloc(1, strlen(s) + 1);
+    strcpy(msg->argv[msg->argc++], s);
+    msg->argv[msg->argc] = NULL;
+}
+
+/* Appends the attributes in attr to the strings of msg */
+void tacd_add_attrib_args(struct tacd_msg *msg, struct tac_attrib *attr) {
+    for (; attr != NULL; attr = attr->next)
+        tacd_add_arg(msg, attr->attr);
+}
+
+/* Builds an attribute list out of the strings of msg starting at first */
+void tacd_args_attrib(struct tacd_msg *msg, int first,
+    struct tac_attrib **attr) {
+
+    char *name, *sep;
+    int i;
+
+    for (i = first; i < msg->argc; i++) {
+        name = (char *) xcalloc(1, strlen(msg->argv[i]) + 1);
+        strcpy(name, msg->argv[i]);
+        sep = name + strcspn(name, "=*");
+        if (*sep != '\0') {
+            char c = *sep;
+
+            *sep = '\0';
+            tac_add_attrib_pair(attr, name, c, sep + 1);
+        } else {
+            tac_add_attrib(attr, name, NULL);
+        }
+        free(name);
+    }
+}
+
+void tacd_free_msg(struct tacd_msg *msg) {
+    int i;
+
+    for (i = 0; i < msg->argc; i++) {
+        bzero(msg->argv[i], strlen(msg->argv[i]));
+        free(msg->argv[i]);
+    }
+    free(msg->argv);
+    msg->argv = NULL;
+    msg->argc = 0;
+}
+
+/* Sends req to the broker listening on path and waits at most timeout
+ * milliseconds for its reply.
+ *
+ * return value:
+ *      0 : success, rep must be released with tacd_free_msg()
+ *   <  0 : broker not running or not answering, the caller should
+ *          talk to the servers itself
+ */
+int tacd_call(const char *path, struct tacd_msg *req, struct tacd_msg *rep,
+    int timeout) {
+
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        TACDEBUG((LOG_DEBUG, "%s: broker %s not available: %m", __FUNCTION__,\
+            path))
+        close(fd);
+        return -1;
+    }
+
+    if (tacd_write_msg(fd, req) < 0 || tacd_read_msg(fd, rep, timeout) < 0
+        || rep->op != req->op) {
+        TACSYSLOG((LOG_ERR, "%s: no reply from broker %s", __FUNCTION__, path))
+        if (rep->argv != NULL)
+            tacd_free_msg(rep);
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}    /* tacd_call */
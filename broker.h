@@ -0,0 +1,81 @@
+/* broker.h - Framing between pam_tacplus and the tacplusd broker.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#ifndef _BROKER_H
+#define _BROKER_H
+
+#include "libtac.h"
+
+#define TACD_SOCKET "/run/tacplusd.sock"
+
+#define TACD_VERSION 1
+
+/* Every message, request or reply, is a fixed header followed by argc
+ * strings, each a 16 bit length in network byte order and the bytes
+ * without terminating NUL.
+ *
+ *   op                  arg (request)    argv (request)
+ *   TACD_OP_AUTHEN      -                user, pass, tty, r_addr
+ *   TACD_OP_AUTHOR      -                user, tty, r_addr, attributes...
+ *   TACD_OP_ACCT        TAC_PLUS_ACCT_FLAG_* [| TACD_ACCT_ALL]
+ *                                        user, tty, r_addr, attributes...
+ *
+ * A reply carries the same op, the TACACS+ status (or a negative
+ * LIBTAC_STATUS_... code) in arg and:
+ *   TACD_OP_AUTHEN      server_msg, address of the server that answered
+ *   TACD_OP_AUTHOR      msg, attributes...
+ *   TACD_OP_ACCT        msg
+ */
+#define TACD_OP_AUTHEN  1
+#define TACD_OP_AUTHOR  2
+#define TACD_OP_ACCT    3
+
+/* send accounting to all servers, not only to the first available one */
+#define TACD_ACCT_ALL   0x100
+
+struct tacd_hdr {
+    u_char version;
+    u_char op;
+    u_int16_t argc;
+    int32_t arg;
+    u_int32_t length;       /* of the strings following the header */
+};
+
+#define TACD_HDR_SIZE 12
+#define TACD_MAX_LENGTH 65536
+
+struct tacd_msg {
+    int op;
+    int arg;
+    int argc;
+    char **argv;
+};
+
+/* broker.c */
+extern int tacd_write_msg(int fd, struct tacd_msg *msg);
+extern int tacd_read_msg(int fd, struct tacd_msg *msg, int timeout);
+extern void tacd_free_msg(struct tacd_msg *msg);
+extern void tacd_add_arg(struct tacd_msg *msg, const char *s);
+extern void tacd_add_attrib_args(struct tacd_msg *msg,
+    struct tac_attrib *attr);
+extern void tacd_args_attrib(struct tacd_msg *msg, int first,
+    struct tac_attrib **attr);
+extern int tacd_call(const char *path, struct tacd_msg *req,
+    struct tacd_msg *rep, int timeout);
+
+#endif
@@ -85,17 +85,75 @@ struct msg_status {
 };
 typedef struct msg_status msg_status;
 
-#ifndef TAC_PLUS_MAXSERVERS		
-#define TAC_PLUS_MAXSERVERS 4
-#endif
+/* TACACS+ server, an entry of the server table */
+struct tac_server {
+    struct addrinfo *addr;
+    char *key;
+    int timeout;        /* connect timeout in seconds, 0 for tac_timeout */
+    int weight;
+    int keepalive;      /* seconds, 0 for tac_keepalive */
+    int user_timeout;   /* milliseconds, 0 for tac_user_timeout */
+    char *host;         /* as given, for the TLS certificate check */
+};
+
+/* MD5 implementation, see digest.c */
+struct tac_md5_provider {
+    const char *name;
+    /* XORs the encryption pad of hdr and key into len bytes of buf */
+    void (*pad)(u_char *buf, int len, HDR *hdr, const char *key);
+    /* MD5 of the n parts, part[i] of len[i] bytes, one after another */
+    void (*digest)(u_char *out, u_char **part, unsigned int *len, int n);
+    /* MD5 of each of n separate messages, like MD5Multi() */
+    void (*multi)(int n, u_char **msg, unsigned int *len, u_char **out);
+};
+
+/* A packet body for _tac_crypt_batch() */
+struct tac_crypt_job {
+    u_char *buf;
+    int len;
+    HDR *th;
+    char *key;          /* NULL or "" if not encrypted */
+};
+
+/* Named group of servers, a run of the server table */
+struct tac_group {
+    char *name;
+    int first;
+    int no;
+};
+
+/* group of the servers given without group= */
+#define TAC_PLUS_GROUP_DEFAULT "default"
+#define TAC_PLUS_MAXWEIGHT 100
+
+/* server selection policies, see tac_health_balance() */
+#define TAC_BALANCE_ORDER   0   /* fastest healthy server first */
+#define TAC_BALANCE_WRR     1   /* weighted round-robin */
+#define TAC_BALANCE_P2C     2   /* faster of two picked at random */
+#define TAC_BALANCE_USER    3   /* consistent hashing on the user name */
 
 #ifndef TAC_PLUS_PORT
 #define	TAC_PLUS_PORT 49
 #endif
 
+#ifndef TAC_PLUS_TLS_PORT
+#define TAC_PLUS_TLS_PORT 300
+#endif
+
+#define TAC_PLUS_HEALTH_FILE "/run/pam_tacplus.health"
+
 #define TAC_PLUS_READ_TIMEOUT  180    /* seconds */
+#define TAC_PLUS_MAX_BODY      65536  /* bytes, larger replies are refused */
 #define TAC_PLUS_WRITE_TIMEOUT 180    /* seconds */
 
+/* defaults of tac_connect_delay, tac_pool_idle, tac_dns_ttl,
+ * tac_health_holddown and tac_retry_budget */
+#define TAC_PLUS_CONNECT_DELAY 250    /* milliseconds */
+#define TAC_PLUS_POOL_IDLE     60     /* seconds */
+#define TAC_PLUS_DNS_TTL       300    /* seconds */
+#define TAC_PLUS_HOLDDOWN      30     /* seconds */
+#define TAC_PLUS_RETRY_BUDGET  10     /* percent */
+
 /* Internal status codes 
  *   all negative, tacplus status codes are >= 0
  */
@@ -110,6 +168,10 @@ typedef struct msg_status msg_status;
 #define LIBTAC_STATUS_CONN_TIMEOUT  -8
 #define LIBTAC_STATUS_CONN_ERR      -9
 
+/* What a non-blocking session waits for, see tac_session_events() */
+#define TAC_SESSION_READ  0x01
+#define TAC_SESSION_WRITE 0x02
+
 /* Runtime flags */
 
 /* version.c */
@@ -131,32 +193,163 @@ extern int tac_readtimeout_enable;
 
 /* connect.c */
 extern int tac_timeout;
+extern int tac_connect_delay;
+extern int tac_fastopen;
+extern int tac_keepalive;
+extern int tac_user_timeout;
+extern int tac_deadline_ms;
+extern long tac_deadline;
+extern void tac_deadline_start(void);
+extern int _tac_time_left(int msecs);
 extern int tac_connect(struct addrinfo **server, char **key, int servers);
 extern int tac_connect_single(struct addrinfo *server, char *key);
+extern int tac_connect_start(struct addrinfo *server);
+extern int tac_connect_finish(int fd, struct addrinfo *server, char *key,
+    long start);
+extern int tac_connect_parallel(struct addrinfo **server, char **key,
+    int servers, int *winner);
+extern int tac_connect_all(struct addrinfo **server, int servers, int *fd);
+extern int tac_alive(int fd);
+extern void tac_set_key(char *key);
 extern char *tac_ntop(const struct sockaddr *sa, size_t ai_addrlen);
+extern long _tac_now_msecs(void);
 
 extern int tac_authen_send(int fd, const char *user, char *pass, char *tty,
     char *r_addr, int action, int ctrl);
 extern void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq);
 extern int tac_cont_send(int fd, char *pass, int ctrl, int seq);
+extern int _tac_authen_pkt(int fd, const char *user, char *pass, char *tty,
+    char *r_addr, int action, int ctrl, u_char **out);
+extern int _tac_cont_pkt(int fd, char *pass, int ctrl, int seq, u_char **out);
+extern void _tac_authen_reply(msg_status *msgstatus, HDR *th, u_char *body,
+    int ctrl, int *seq);
 extern HDR *_tac_req_header(u_char type, int cont_session);
+extern u_char *_tac_pkt_join(HDR *th, u_char *body, int length);
+extern int _tac_write_pkt(int fd, u_char *pkt, int length);
 extern void _tac_crypt(u_char *buf, HDR *th, int length);
-extern u_char *_tac_md5_pad(int len, HDR *hdr);
+extern void _tac_xor(u_char *buf, const u_char *pad, int len);
+extern int _tac_xor_select(int width);
+extern void _tac_crypt_batch(struct tac_crypt_job *job, int n);
 extern void tac_add_attrib(struct tac_attrib **attr, char *name, char *value);
 extern void tac_free_attrib(struct tac_attrib **attr);
 extern char *tac_acct_flag2str(int flag);
 extern int tac_acct_send(int fd, int type, const char *user, char *tty, char *r_addr,
     struct tac_attrib *attr);
 extern int tac_acct_read(int fd, struct areply *arep);
+extern int _tac_acct_pkt(int fd, int type, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr, u_char **out);
+extern int _tac_acct_body(int type, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr, u_char **out);
+extern int _tac_acct_reply(HDR *th, u_char *body, struct areply *re);
 extern void *xcalloc(size_t nmemb, size_t size);
 extern void *xrealloc(void *ptr, size_t size);
 extern char *_tac_check_header(HDR *th, int type);
 extern int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
     struct tac_attrib *attr);
 extern int tac_author_read(int fd, struct areply *arep);
+extern int _tac_author_pkt(int fd, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr, u_char **out);
+extern int _tac_author_reply(HDR *th, u_char *body, struct areply *re);
 extern void tac_add_attrib_pair(struct tac_attrib **attr, char *name, char sep,
     char *value);
-extern int tac_read_wait(int fd, int timeout, int size, int *time_left);
+extern int tac_readn(int fd, void *buf, int len, int *timeleft);
+extern int tac_writen(int fd, const void *buf, int len);
+
+/* sconn.c */
+extern int tac_single_connect;
+extern int tac_sconn_enabled(int fd);
+extern int tac_close(int fd);
+extern u_char _tac_sconn_flags(int fd);
+extern void _tac_sconn_drop(int fd);
+extern int _tac_read_reply(int fd, int type, HDR *th, u_char **body);
+extern int _tac_sconn_take(int fd, HDR *th, u_char **body);
+extern int _tac_sconn_route(int fd, HDR *th, u_char *body);
+extern int _tac_rx_space(int fd, u_char **p);
+extern void _tac_rx_commit(int fd, int n);
+extern int _tac_rx_pkt(int fd, HDR *th, u_char **body);
+extern int _tac_rx_short(int fd);
+extern int _tac_rx_fill(int fd);
+
+/* tls.c */
+extern int tac_tls;
+extern char *tac_tls_ca;
+extern char *tac_tls_cert;
+extern char *tac_tls_key;
+extern int tac_tls_connect(int *fd, struct addrinfo **server, int n);
+extern int tac_tls_active(int fd);
+extern ssize_t _tac_tls_read(int fd, void *buf, size_t len);
+extern ssize_t _tac_tls_write(int fd, const void *buf, size_t len);
+extern int _tac_tls_alive(int fd);
+extern void _tac_tls_close(int fd, int notify);
+
+/* digest.c */
+extern int tac_crypto_select(const char *name);
+extern const char *tac_crypto_name(void);
+extern const struct tac_md5_provider *_tac_md5(void);
+
+/* pool.c */
+extern int tac_pool_idle;
+extern int tac_pool_get(struct addrinfo *server, char *key);
+extern void tac_pool_put(int fd, struct addrinfo *server, char *key);
+extern void tac_pool_reap(void);
+extern int tac_connect_pooled(struct addrinfo *server, char *key);
+
+/* health.c */
+extern char *tac_health_file;
+extern int tac_health_holddown;
+extern void tac_health_connect(struct addrinfo *server, int msecs);
+extern void tac_health_reply(int fd, int msecs);
+extern void tac_health_order(struct addrinfo **server, char **key,
+    int servers);
+extern int tac_retry_budget;
+extern int tac_health_reply_limit(struct addrinfo *server);
+extern void tac_health_budget_earn(void);
+extern int tac_health_budget_spend(void);
+extern int tac_balance;
+extern void tac_health_balance(struct addrinfo **server, char **key,
+    int servers, const char *user);
+
+/* resolve.c */
+extern int tac_dns_ttl;
+extern void tac_resolve(char **host, char **port, struct addrinfo **res,
+    int n);
+
+/* srvtab.c */
+extern struct tac_server *tac_server;
+extern int tac_server_no;
+extern struct tac_group *tac_group;
+extern int tac_group_no;
+extern void tac_srvtab_reset(void);
+extern int tac_srvtab_add(const char *arg);
+extern void tac_srvtab_key(const char *key);
+extern void tac_srvtab_build(void);
+extern int tac_srvtab_group(const char *name, struct addrinfo ***server,
+    char ***key);
+extern int tac_srvtab_timeout(struct addrinfo *server);
+extern int tac_srvtab_weight(struct addrinfo *server);
+extern int tac_srvtab_keepalive(struct addrinfo *server);
+extern int tac_srvtab_user_timeout(struct addrinfo *server);
+extern const char *tac_srvtab_host(struct addrinfo *server);
+
+/* session.c */
+struct tac_session;
+extern struct tac_session *tac_session_authen(int fd, const char *user,
+    char *pass, char *tty, char *r_addr, int action, int ctrl);
+extern struct tac_session *tac_session_author(int fd, const char *user,
+    char *tty, char *r_addr, struct tac_attrib *attr);
+extern struct tac_session *tac_session_acct(int fd, int type,
+    const char *user, char *tty, char *r_addr, struct tac_attrib *attr);
+extern int tac_session_cont(struct tac_session *s, char *data);
+extern int tac_session_fd(struct tac_session *s);
+extern int tac_session_events(struct tac_session *s);
+extern int tac_session_timeout(struct tac_session *s);
+extern int tac_session_step(struct tac_session *s);
+extern int tac_session_result(struct tac_session *s, struct areply *re);
+extern void tac_session_free(struct tac_session *s);
+extern void tac_session_run(struct tac_session **s, int n);
+extern int tac_acct_all(int type, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr, struct addrinfo **server, char **key,
+    int servers, int *status);
 
 #ifdef __cplusplus
 }
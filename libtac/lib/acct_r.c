@@ -34,73 +34,31 @@
  */
 int tac_acct_read(int fd, struct areply *re) {
     HDR th;
-    struct acct_reply *tb = NULL;
-    int len_from_header, r, len_from_body;
-    char *msg = NULL;
-    int timeleft;
+    u_char *body = NULL;
+    int r;
     re->attr = NULL; /* unused */
     re->msg = NULL;
 
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,tac_timeout*1000, TAC_PLUS_HDR_SIZE,&timeleft) < 0 ) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-        re->msg = xstrdup(acct_syserr_msg);
-        re->status = LIBTAC_STATUS_READ_TIMEOUT;
-        free(tb);
-        return re->status;
-    }
-
-    r=read(fd, &th, TAC_PLUS_HDR_SIZE);
-    if(r < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply header, read %d of %d: %m", __FUNCTION__,\
-            r, TAC_PLUS_HDR_SIZE))
-        re->msg = xstrdup(acct_syserr_msg);
-        re->status = LIBTAC_STATUS_SHORT_HDR;
-        free(tb);
-        return re->status;
-    }
-
-    /* check the reply fields in header */
-    msg = _tac_check_header(&th, TAC_PLUS_ACCT);
-    if(msg != NULL) {
-        re->msg = xstrdup(msg);
-        re->status = LIBTAC_STATUS_PROTOCOL_ERR;
-        free(tb);
-        TACDEBUG((LOG_DEBUG, "%s: exit status=%d, status message \"%s\"",\
-            __FUNCTION__, re->status, re->msg != NULL ? re->msg : ""))
-        return re->status;
-    }
-
-    len_from_header=ntohl(th.datalength);
-    tb=(struct acct_reply *) xcalloc(1, len_from_header);
-
-    /* read reply packet body */
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,timeleft,len_from_header,NULL) < 0 ) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-        re->msg = xstrdup(acct_syserr_msg);
-        re->status = LIBTAC_STATUS_READ_TIMEOUT;
-        free(tb);
+    /* read the reply for this session */
+    r = _tac_read_reply(fd, TAC_PLUS_ACCT, &th, &body);
+    if (r < 0) {
+        re->msg = xstrdup(r == LIBTAC_STATUS_PROTOCOL_ERR ?
+            protocol_err_msg : acct_syserr_msg);
+        re->status = r;
         return re->status;
     }
+    return _tac_acct_reply(&th, body, re);
+}
 
-    r=read(fd, tb, len_from_header);
-    if(r < len_from_header) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply body, read %d of %d: %m",\
-            __FUNCTION__,\
-            r, len_from_header))
-        re->msg = xstrdup(acct_syserr_msg);
-        re->status = LIBTAC_STATUS_SHORT_BODY;
-        free(tb);
-        return re->status;
-    }
+/* Decodes the accounting reply body (decrypted on receipt) read with
+ * header th into re, as tac_acct_read() does. body is freed.
+ */
+int _tac_acct_reply(HDR *th, u_char *body, struct areply *re) {
+    struct acct_reply *tb = (struct acct_reply *) body;
+    int len_from_header, len_from_body;
+    char *msg = NULL;
 
-    /* decrypt the body */
-    _tac_crypt((u_char *) tb, &th, len_from_header);
+    len_from_header = ntohl(th->datalength);
 
     /* Convert network byte order to host byte order */
     tb->msg_len  = ntohs(tb->msg_len);
@@ -121,7 +79,6 @@ int tac_acct_read(int fd, struct areply *re) {
     }
 
     /* save status and clean up */
-    r=tb->status;
     if(tb->msg_len) {
         msg=(char *) xcalloc(1, tb->msg_len+1);
         bcopy((u_char *) tb+TAC_ACCT_REPLY_FIXED_FIELDS_SIZE, msg, tb->msg_len); 
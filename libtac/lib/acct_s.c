@@ -37,27 +37,18 @@ char *tac_acct_flag2str(int flag) {
     }
 }
 
-/*
+/* Build accounting request; header and encrypted body are returned
+ * in *out, to be freed by caller.
+ *
  * return value:
- *      0 : success
- *   <  0 : error status code, see LIBTAC_STATUS_...
- *             LIBTAC_STATUS_WRITE_ERR
- *             LIBTAC_STATUS_WRITE_TIMEOUT  (pending impl)
- *             LIBTAC_STATUS_ASSEMBLY_ERR   (pending impl)
+ *   >  0 : length of packet
  */
-int tac_acct_send(int fd, int type, const char *user, char *tty,
-    char *r_addr, struct tac_attrib *attr) {
+int _tac_acct_pkt(int fd, int type, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr, u_char **out) {
 
     HDR *th;
-    struct acct tb;
-    u_char user_len, port_len, r_addr_len;
-    struct tac_attrib *a;
-    int i = 0;    /* arg count */
     int pkt_len = 0;
-    int pktl = 0;
-    int w;    /* write count */
     u_char *pkt=NULL;
-    /* u_char *pktp; */             /* obsolute */
     int ret = 0;
 
     th = _tac_req_header(TAC_PLUS_ACCT, 0);
@@ -65,11 +56,45 @@ int tac_acct_send(int fd, int type, const char *user, char *tty,
     /* set header options */
     th->version=TAC_PLUS_VER_0;
     th->encryption=tac_encryption ? TAC_PLUS_ENCRYPTED_FLAG : TAC_PLUS_UNENCRYPTED_FLAG;
+    th->encryption|=_tac_sconn_flags(fd);
 
     TACDEBUG((LOG_DEBUG, "%s: user '%s', tty '%s', rem_addr '%s', encrypt: %s, type: %s", \
         __FUNCTION__, user, tty, r_addr, \
         (tac_encryption) ? "yes" : "no", \
         tac_acct_flag2str(type)))
+
+    pkt_len = _tac_acct_body(type, user, tty, r_addr, attr, &pkt);
+
+    /* finished building packet, fill len_from_header in header */
+    th->datalength = htonl(pkt_len);
+
+    /* encrypt packet body  */
+    _tac_crypt(pkt, th, pkt_len);
+
+    *out = _tac_pkt_join(th, pkt, pkt_len);
+    ret = TAC_PLUS_HDR_SIZE + pkt_len;
+
+    free(pkt);
+    free(th);
+    return ret;
+} /* _tac_acct_pkt */
+
+/* Build the body of an accounting request, not encrypted yet, in
+ * *out, to be freed by caller.
+ *
+ * return value:
+ *   >  0 : length of body
+ */
+int _tac_acct_body(int type, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr, u_char **out) {
+
+    struct acct tb;
+    u_char user_len, port_len, r_addr_len;
+    struct tac_attrib *a;
+    int i = 0;    /* arg count */
+    int pkt_len = 0;
+    int pktl = 0;
+    u_char *pkt=NULL;
         
     user_len=(u_char) strlen(user);
     port_len=(u_char) strlen(tty);
@@ -147,33 +172,29 @@ int tac_acct_send(int fd, int type, const char *user, char *tty,
         a = a->next;
     }
 
-    /* finished building packet, fill len_from_header in header */
-    th->datalength = htonl(pkt_len);
+    *out = pkt;
+    return pkt_len;
+} /* _tac_acct_body */
 
-    /* write header */
-    w = write(fd, th, TAC_PLUS_HDR_SIZE);
-
-    if(w < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR, "%s: short write on header, wrote %d of %d: %m",\
-            __FUNCTION__, w, TAC_PLUS_HDR_SIZE))
-        free(pkt);
-        free(th);
-        return LIBTAC_STATUS_WRITE_ERR;
-    }
-        
-    /* encrypt packet body  */
-    _tac_crypt(pkt, th, pkt_len);
+/*
+ * return value:
+ *      0 : success
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *             LIBTAC_STATUS_WRITE_ERR
+ *             LIBTAC_STATUS_WRITE_TIMEOUT
+ *             LIBTAC_STATUS_ASSEMBLY_ERR   (pending impl)
+ */
+int tac_acct_send(int fd, int type, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr) {
 
-    /* write body */
-    w=write(fd, pkt, pkt_len);
-    if(w < pkt_len) {
-        TACSYSLOG((LOG_ERR, "%s: short write on body, wrote %d of %d: %m",\
-            __FUNCTION__, w, pkt_len))
-        ret = LIBTAC_STATUS_WRITE_ERR;
-    }
+    u_char *pkt = NULL;
+    int ret;
 
+    ret = _tac_acct_pkt(fd, type, user, tty, r_addr, attr, &pkt);
+    if (ret > 0)
+        ret = _tac_write_pkt(fd, pkt, ret);
     free(pkt);
-    free(th);
+
     TACDEBUG((LOG_DEBUG, "%s: exit status=%d", __FUNCTION__, ret))
     return ret;
 }
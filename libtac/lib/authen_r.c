@@ -39,70 +39,35 @@
  */
 void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq) {
     HDR th;
-    struct authen_reply *tb = NULL;
-    int len_from_header, r, len_from_body, msg_len, data_len;
-    char *hdr_err = NULL;
-    int timeleft;
+    u_char *body = NULL;
     int status;
 
-    /* Message Body Fields */
-	char *server_msg = NULL;
-    u_char *data = NULL;
-
     /* Return Struct */
     //msgstatus = malloc (sizeof(msg_status));
 
-    /* read the reply header */
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,tac_timeout*1000,TAC_PLUS_HDR_SIZE,&timeleft) < 0 ) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-		msgstatus->status=LIBTAC_STATUS_READ_TIMEOUT;
-        free(tb);
-        exit;
-    }
-    r = read(fd, &th, TAC_PLUS_HDR_SIZE);
-    if (r < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply header, read %d of %d: %m",\
-            __FUNCTION__,\
-            r, TAC_PLUS_HDR_SIZE))
-		msgstatus->status=LIBTAC_STATUS_SHORT_HDR;
-        free(tb);
-        exit;
+    /* read the reply for this session */
+    status = _tac_read_reply(fd, TAC_PLUS_AUTHEN, &th, &body);
+    if (status < 0) {
+        msgstatus->status = status;
+        return;
     }
+    _tac_authen_reply(msgstatus, &th, body, ctrl, seq);
+}    /* tac_authen_read */
 
-    /* check the reply fields in header */
-    hdr_err = _tac_check_header(&th, TAC_PLUS_AUTHEN);
-    if(hdr_err != NULL) {
-    	msgstatus->status = LIBTAC_STATUS_PROTOCOL_ERR;
-        free(tb);
-        exit;
-    }
- 
-    len_from_header = ntohl(th.datalength);
-    tb = (struct authen_reply *) xcalloc(1, len_from_header);
+/* Decodes the authentication reply body (decrypted on receipt) read with
+ * header th into msgstatus and *seq, as tac_authen_read() does.
+ * body is freed.
+ */
+void _tac_authen_reply(msg_status *msgstatus, HDR *th, u_char *body,
+    int ctrl, int *seq) {
+    struct authen_reply *tb = (struct authen_reply *) body;
+    int len_from_header, r, len_from_body, msg_len, data_len;
 
-    /* read reply packet body */
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,timeleft,len_from_header,NULL) < 0 ) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-		msgstatus->status=LIBTAC_STATUS_READ_TIMEOUT;
-    }
-    r = read(fd, tb, len_from_header);
-    if (r < len_from_header) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply body, read %d of %d: %m",\
-            __FUNCTION__,\
-            r, len_from_header))
-		msgstatus->status = LIBTAC_STATUS_SHORT_BODY;
-        free(tb);
-        exit;
-    }
+    /* Message Body Fields */
+	char *server_msg = NULL;
+    u_char *data = NULL;
 
-    /* decrypt the body */
-    _tac_crypt((u_char *) tb, &th, len_from_header);
+    len_from_header = ntohl(th->datalength);
 
     /* Convert network byte order to host byte order */
     msg_len  = ntohs(tb->msg_len);
@@ -119,7 +84,7 @@ void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq) {
             __FUNCTION__))
 		msgstatus->status = LIBTAC_STATUS_PROTOCOL_ERR;
         free(tb);
-        exit;
+        return;
     }
 
     /* Extract server_msg and data */
@@ -141,7 +106,7 @@ void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq) {
     msgstatus->status = r;
 
     /* grab the return sequence no */
-    *seq = th.seq_no;
+    *seq = th->seq_no;
 
     if (ctrl & PAM_TAC_DEBUG) {
 		switch (r) {
@@ -170,9 +135,9 @@ void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq) {
 	/* Packet Debug (In 'debug tacacs packet' format */
     if (ctrl & PAM_TAC_PACKET_DEBUG) {
 		TACDEBUG((LOG_DEBUG, "T+: Version %u (0x%02X), type %u, seq %u, encryption %u",
-			th.version, th.version, th.type, th.seq_no, th.encryption))
+			th->version, th->version, th->type, th->seq_no, th->encryption))
 		TACDEBUG((LOG_DEBUG, "T+: session_id %u (0x%08X), dlen %u (0x%02X)",
-			th.session_id, th.session_id, th.datalength, th.datalength))
+			th->session_id, th->session_id, th->datalength, th->datalength))
 		TACDEBUG((LOG_DEBUG, "T+: type:AUTHEN/REPLY status:%d flags:%02X msg_len:%u, data_len:%u",
 			tb->status, tb->flags, msg_len, data_len))
 		TACDEBUG((LOG_DEBUG, "T+: msg:  %s", server_msg))
@@ -181,4 +146,4 @@ void tac_authen_read(msg_status *msgstatus, int fd, int ctrl, int *seq) {
     }
 
     free(tb);
-}    /* tac_authen_read */
+}    /* _tac_authen_reply */
@@ -25,30 +25,28 @@
 #include "md5.h"
 #include "pam_tacplus.h"
 
-/* this function sends a packet do TACACS+ server, asking
- * for validation of given username and password
+/* this function builds a packet for TACACS+ server, asking
+ * for validation of given username and password; header and
+ * encrypted body are returned in *out, to be freed by caller
  *
  * return value:
- *      0 : success
+ *   >  0 : length of packet
  *   <  0 : error status code, see LIBTAC_STATUS_...
- *             LIBTAC_STATUS_WRITE_ERR
- *             LIBTAC_STATUS_WRITE_TIMEOUT
  *             LIBTAC_STATUS_ASSEMBLY_ERR
  */
-int tac_authen_send(int fd, const char *user, char *pass, char *tty,
-    char *r_addr, int action, int ctrl) {
+int _tac_authen_pkt(int fd, const char *user, char *pass, char *tty,
+    char *r_addr, int action, int ctrl, u_char **out) {
 
     HDR *th;    /* TACACS+ packet header */
     struct authen_start tb;     /* message body */
-    int user_len, port_len, chal_len, mdp_len, token_len, bodylength, w;
+    int user_len, port_len, chal_len, token_len, bodylength;
     int r_addr_len;
     int pkt_len = 0;
     int ret = 0;
     char *chal = "1234123412341234";
     char digest[MD5_LEN];
     char *token = NULL;
-    u_char *pkt = NULL, *mdp = NULL;
-    MD5_CTX mdcontext;
+    u_char *pkt = NULL;
 
     th=_tac_req_header(TAC_PLUS_AUTHEN, 0);
 
@@ -59,6 +57,7 @@ int tac_authen_send(int fd, const char *user, char *pass, char *tty,
         th->version = TAC_PLUS_VER_1;
     }
     th->encryption = tac_encryption ? TAC_PLUS_ENCRYPTED_FLAG : TAC_PLUS_UNENCRYPTED_FLAG;
+    th->encryption |= _tac_sconn_flags(fd);
 
     if (ctrl & PAM_TAC_DEBUG)
     	TACDEBUG((LOG_DEBUG, "%s: user '%s', tty '%s', rem_addr '%s', encrypt: %s", \
@@ -66,16 +65,19 @@ int tac_authen_send(int fd, const char *user, char *pass, char *tty,
 			(tac_encryption) ? "yes" : "no"))
         
     if ((tac_login != NULL) && (strcmp(tac_login,"chap") == 0)) {
+        /* MD5{id, password, challenge} */
+        u_char id = 5;
+        u_char *mdp[3];
+        unsigned int mdp_len[3];
+
         chal_len = strlen(chal);
-        mdp_len = sizeof(u_char) + strlen(pass) + chal_len;
-        mdp = (u_char *) xcalloc(1, mdp_len);
-        mdp[0] = 5;
-        memcpy(&mdp[1], pass, strlen(pass));
-        memcpy(mdp + strlen(pass) + 1, chal, chal_len);
-        MD5Init(&mdcontext);
-        MD5Update(&mdcontext, mdp, mdp_len);
-        MD5Final((u_char *) digest, &mdcontext);
-        free(mdp);
+        mdp[0] = &id;
+        mdp_len[0] = sizeof(u_char);
+        mdp[1] = (u_char *) pass;
+        mdp_len[1] = strlen(pass);
+        mdp[2] = (u_char *) chal;
+        mdp_len[2] = chal_len;
+        _tac_md5()->digest((u_char *) digest, mdp, mdp_len, 3);
         token = (char*) xcalloc(1, sizeof(u_char) + 1 + chal_len + MD5_LEN);
         token[0] = 5;
         memcpy(&token[1], chal, chal_len);
@@ -117,18 +119,6 @@ int tac_authen_send(int fd, const char *user, char *pass, char *tty,
 
     th->datalength = htonl(bodylength);
 
-    /* we can now write the header */
-    w = write(fd, th, TAC_PLUS_HDR_SIZE);
-    if (w < 0 || w < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short write on header, wrote %d of %d: %m",\
-            __FUNCTION__, w, TAC_PLUS_HDR_SIZE))
-        free(token);
-        free(pkt);
-        free(th);
-        return LIBTAC_STATUS_WRITE_ERR;
-    }
-
     /* build the packet */
     pkt = (u_char *) xcalloc(1, bodylength+10);
 
@@ -157,13 +147,8 @@ int tac_authen_send(int fd, const char *user, char *pass, char *tty,
     /* encrypt the body */
     _tac_crypt(pkt, th, bodylength);
 
-    w = write(fd, pkt, pkt_len);
-    if (w < 0 || w < pkt_len) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short write on body, wrote %d of %d: %m",\
-            __FUNCTION__, w, pkt_len))
-        ret = LIBTAC_STATUS_WRITE_ERR;
-    }
+    *out = _tac_pkt_join(th, pkt, pkt_len);
+    ret = TAC_PLUS_HDR_SIZE + pkt_len;
 
     /* Packet Debug (In 'debug tacacs packet' format */
     if (ctrl & PAM_TAC_PACKET_DEBUG) {
@@ -200,6 +185,30 @@ int tac_authen_send(int fd, const char *user, char *pass, char *tty,
     free(pkt);
     free(th);
 
+    return ret;
+}    /* _tac_authen_pkt */
+
+/* this function sends a packet do TACACS+ server, asking
+ * for validation of given username and password
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *             LIBTAC_STATUS_WRITE_ERR
+ *             LIBTAC_STATUS_WRITE_TIMEOUT
+ *             LIBTAC_STATUS_ASSEMBLY_ERR
+ */
+int tac_authen_send(int fd, const char *user, char *pass, char *tty,
+    char *r_addr, int action, int ctrl) {
+
+    u_char *pkt = NULL;
+    int ret;
+
+    ret = _tac_authen_pkt(fd, user, pass, tty, r_addr, action, ctrl, &pkt);
+    if (ret > 0)
+        ret = _tac_write_pkt(fd, pkt, ret);
+    free(pkt);
+
     if (ctrl & PAM_TAC_DEBUG)
     	TACDEBUG((LOG_DEBUG, "%s: exit status=%d", __FUNCTION__, ret))
     return ret;
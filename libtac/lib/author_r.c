@@ -40,73 +40,30 @@
  */
 int tac_author_read(int fd, struct areply *re) {
     HDR th;
-    struct author_reply *tb = NULL;
-    int len_from_header, r, len_from_body;
-    u_char *pktp = NULL;
-    char *msg = NULL;
-    int timeleft;
-    re->msg = NULL;
+    u_char *body = NULL;
+    int r;
 
     bzero(re, sizeof(struct areply));
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,tac_timeout*1000,TAC_PLUS_HDR_SIZE,&timeleft) < 0 ) {
-
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-        re->msg = xstrdup(author_syserr_msg);
-        re->status = LIBTAC_STATUS_READ_TIMEOUT;
-        free(tb);
-        return re->status;
-    }
-
-    r = read(fd, &th, TAC_PLUS_HDR_SIZE);
-    if(r < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply header, read %d of %d: %m", __FUNCTION__,\
-            r, TAC_PLUS_HDR_SIZE))
-        re->msg = xstrdup(author_syserr_msg);
-        re->status = LIBTAC_STATUS_SHORT_HDR;
-        free(tb);
-        return re->status;
-    }
-
-    /* check header consistency */
-    msg = _tac_check_header(&th, TAC_PLUS_AUTHOR);
-    if (msg != NULL) {
-        /* no need to process body if header is broken */
-        re->msg = xstrdup(msg);
-        re->status = LIBTAC_STATUS_PROTOCOL_ERR;
-        free(tb);
+    /* read the reply for this session */
+    r = _tac_read_reply(fd, TAC_PLUS_AUTHOR, &th, &body);
+    if (r < 0) {
+        re->msg = xstrdup(r == LIBTAC_STATUS_PROTOCOL_ERR ?
+            protocol_err_msg : author_syserr_msg);
+        re->status = r;
         return re->status;
     }
+    return _tac_author_reply(&th, body, re);
+}
 
-    len_from_header = ntohl(th.datalength);
-    tb = (struct author_reply *) xcalloc(1, len_from_header);
-
-    /* read reply packet body */
-    if (tac_readtimeout_enable &&
-        tac_read_wait(fd,timeleft,len_from_header,NULL) < 0 ) {
-
-        TACSYSLOG((LOG_ERR,\
-            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
-        re->msg = xstrdup(author_syserr_msg);
-        re->status = LIBTAC_STATUS_READ_TIMEOUT;
-        free(tb);
-        return re->status;
-    }
-    r = read(fd, tb, len_from_header);
-    if (r < len_from_header) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short reply body, read %d of %d: %m", __FUNCTION__,\
-            r, len_from_header))
-        re->msg = xstrdup(author_syserr_msg);
-        re->status = LIBTAC_STATUS_SHORT_BODY;
-        free(tb);
-        return re->status;
-    }
+/* Decodes the authorization reply body (decrypted on receipt) read with
+ * header th into re, as tac_author_read() does. body is freed.
+ */
+int _tac_author_reply(HDR *th, u_char *body, struct areply *re) {
+    struct author_reply *tb = (struct author_reply *) body;
+    int len_from_header, r, len_from_body;
+    u_char *pktp = NULL;
 
-    /* decrypt the body */
-    _tac_crypt((u_char *) tb, &th, len_from_header);
+    len_from_header = ntohl(th->datalength);
 
     /* Convert network byte order to host byte order */
     tb->msg_len  = ntohs(tb->msg_len);
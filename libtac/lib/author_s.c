@@ -22,18 +22,15 @@
 #include "libtac.h"
 #include "xalloc.h"
 
-/* Send authorization request to the server, along with attributes
-   specified in attribute list prepared with tac_add_attrib.
+/* Build authorization request for the server, along with attributes
+   specified in attribute list prepared with tac_add_attrib. Header
+   and encrypted body are returned in *out, to be freed by caller.
  *
  * return value:
- *      0 : success
- *   <  0 : error status code, see LIBTAC_STATUS_...
- *         LIBTAC_STATUS_WRITE_ERR
- *         LIBTAC_STATUS_WRITE_TIMEOUT (pending impl)
- *         LIBTAC_STATUS_ASSEMBLY_ERR  (pending impl)
+ *   >  0 : length of packet
  */
-int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
-    struct tac_attrib *attr) {
+int _tac_author_pkt(int fd, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr, u_char **out) {
 
     HDR *th;
     struct author tb;
@@ -42,7 +39,6 @@ int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
     int i = 0;              /* attributes count */
     int pkt_len = 0;    /* current packet length */
     int pktl = 0;       /* temporary storage for previous pkt_len values */
-    int w;              /* write() return value */
     u_char *pkt = NULL;         /* packet building pointer */
     /* u_char *pktp; */         /* obsolete */
     int ret = 0;
@@ -52,6 +48,7 @@ int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
     /* set header options */
     th->version=TAC_PLUS_VER_0;
     th->encryption=tac_encryption ? TAC_PLUS_ENCRYPTED_FLAG : TAC_PLUS_UNENCRYPTED_FLAG;
+    th->encryption|=_tac_sconn_flags(fd);
 
     TACDEBUG((LOG_DEBUG, "%s: user '%s', tty '%s', rem_addr '%s', encrypt: %s", \
         __FUNCTION__, user, \
@@ -137,32 +134,38 @@ int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
     /* finished building packet, fill len_from_header in header */
     th->datalength = htonl(pkt_len);
 
-    /* write header */
-    w = write(fd, th, TAC_PLUS_HDR_SIZE);
-
-    if (w < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short write on header, wrote %d of %d: %m",\
-            __FUNCTION__, w, TAC_PLUS_HDR_SIZE))
-        free(pkt);
-        free(th);
-        return LIBTAC_STATUS_WRITE_ERR;
-    }
-    
     /* encrypt packet body  */
     _tac_crypt(pkt, th, pkt_len);
 
-    /* write body */
-    w = write(fd, pkt, pkt_len);
-    if (w < pkt_len) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short write on body, wrote %d of %d: %m",\
-            __FUNCTION__, w, pkt_len))
-        ret = LIBTAC_STATUS_WRITE_ERR;
-    }
+    *out = _tac_pkt_join(th, pkt, pkt_len);
+    ret = TAC_PLUS_HDR_SIZE + pkt_len;
 
     free(pkt);
     free(th);
+    return ret;
+} /* _tac_author_pkt */
+
+/* Send authorization request to the server, along with attributes
+   specified in attribute list prepared with tac_add_attrib.
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *         LIBTAC_STATUS_WRITE_ERR
+ *         LIBTAC_STATUS_WRITE_TIMEOUT
+ *         LIBTAC_STATUS_ASSEMBLY_ERR  (pending impl)
+ */
+int tac_author_send(int fd, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr) {
+
+    u_char *pkt = NULL;
+    int ret;
+
+    ret = _tac_author_pkt(fd, user, tty, r_addr, attr, &pkt);
+    if (ret > 0)
+        ret = _tac_write_pkt(fd, pkt, ret);
+    free(pkt);
+
     TACDEBUG((LOG_DEBUG, "%s: exit status=%d", __FUNCTION__, ret))
     return ret;
 }
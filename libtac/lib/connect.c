@@ -24,6 +24,8 @@
 #include <time.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#include <netinet/tcp.h>
 
 #ifdef _AIX
 #include <sys/socket.h>
@@ -34,6 +36,63 @@
 /* Pointer to TACACS+ connection timeout */
 int tac_timeout = 5;
 
+/* Delay in milliseconds between starting parallel connection attempts */
+int tac_connect_delay = TAC_PLUS_CONNECT_DELAY;
+
+/* Non-zero to send the first packet in the SYN (TCP Fast Open, RFC 7413)
+ * to servers we hold a cookie for; the kernel falls back to a plain
+ * handshake by itself when there is none or the server drops the data.
+ */
+int tac_fastopen = 0;
+
+/* Seconds a connection may be idle before keepalive probes go out, and
+ * milliseconds sent data may stay unacknowledged (TCP_USER_TIMEOUT)
+ * before the connection is given up; 0 leaves the kernel defaults.
+ * Servers can have their own, see tac_srvtab_keepalive().
+ */
+int tac_keepalive = 0;
+int tac_user_timeout = 0;
+
+/* Milliseconds a whole transaction, i.e. connects, failover, requests
+ * and replies, may take at most; 0 for no limit. See tac_deadline_start().
+ */
+int tac_deadline_ms = 0;
+
+/* Time (see _tac_now_msecs) by which the current transaction has to be
+ * done, 0 for none.
+ */
+long tac_deadline = 0;
+
+/* current time on the monotonic clock in milliseconds */
+long _tac_now_msecs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+/* Starts the tac_deadline_ms budget for the transaction that follows */
+void tac_deadline_start(void) {
+    tac_deadline = tac_deadline_ms > 0 ? _tac_now_msecs() + tac_deadline_ms : 0;
+}
+
+/* Returns the milliseconds a step allowed to take msecs (-1 for no
+ * limit) may wait, cut down to what is left of the transaction budget.
+ * 0 once the budget is spent.
+ */
+int _tac_time_left(int msecs) {
+    long left;
+
+    if (tac_deadline == 0)
+        return msecs;
+    left = tac_deadline - _tac_now_msecs();
+    if (left < 0)
+        left = 0;
+    if (msecs >= 0 && msecs < left)
+        return msecs;
+    return (int) left;
+}
+
 /* Returns file descriptor of open connection
    to the first available server from list passed
    in server table.
@@ -50,6 +109,10 @@ int tac_connect(struct addrinfo **server, char **key, int servers) {
         TACSYSLOG((LOG_ERR, "%s: no TACACS+ servers defined", __FUNCTION__))
     } else {
         for ( tries = 0; tries < servers; tries++ ) {   
+            if (_tac_time_left(-1) == 0) {
+                fd = LIBTAC_STATUS_CONN_TIMEOUT;
+                break;
+            }
             if((fd=tac_connect_single(server[tries], key[tries])) >= 0 ) {
                 /* tac_secret was set in tac_connect_single on success */
                 break;
@@ -63,113 +126,625 @@ int tac_connect(struct addrinfo **server, char **key, int servers) {
 } /* tac_connect */
 
 
-/* return value:
- *   >= 0 : valid fd
- *   <  0 : error status code, see LIBTAC_STATUS_...
+/* Makes the kernel notice a server that went away without a word: with
+ * keepalive, three probes keepalive/3 seconds apart follow keepalive
+ * seconds of silence; with a user timeout, data left unacknowledged
+ * that long fails the connection. Either way a read waiting on it
+ * returns an error at once instead of running into tac_timeout.
  */
-int tac_connect_single(struct addrinfo *server, char *key) {
-    int retval = LIBTAC_STATUS_CONN_ERR; /* default retval */
-    int fd = -1;
-    int flags, rc;
-    fd_set readfds, writefds;
-    struct timeval tv;
-    socklen_t len;
-    struct sockaddr_storage addr;
-    char *ip = NULL;
+static void _tac_liveness(int fd, struct addrinfo *server) {
+    int idle = tac_srvtab_keepalive(server);
+    int user_timeout = tac_srvtab_user_timeout(server);
+    int on = 1;
 
-    if(server == NULL) {
-        TACSYSLOG((LOG_ERR, "%s: no TACACS+ server defined", __FUNCTION__))
-        return LIBTAC_STATUS_CONN_ERR;
+    if (idle > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) < 0)
+            TACDEBUG((LOG_DEBUG, "%s: SO_KEEPALIVE: %m", __FUNCTION__))
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        {
+            int intvl = idle / 3 > 0 ? idle / 3 : 1, cnt = 3;
+
+            if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle,
+                    sizeof(idle)) < 0
+                || setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl,
+                    sizeof(intvl)) < 0
+                || setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &cnt,
+                    sizeof(cnt)) < 0)
+                TACDEBUG((LOG_DEBUG, "%s: keepalive intervals: %m",\
+                    __FUNCTION__))
+        }
+#endif
     }
+#ifdef TCP_USER_TIMEOUT
+    if (user_timeout > 0 && setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT,
+        &user_timeout, sizeof(user_timeout)) < 0)
+        TACDEBUG((LOG_DEBUG, "%s: TCP_USER_TIMEOUT: %m", __FUNCTION__))
+#endif
+}
 
-    /* format server address into a string  for use in messages */
-    ip = tac_ntop(server->ai_addr, 0);
 
-    if((fd=socket(server->ai_family, server->ai_socktype, server->ai_protocol)) < 0) {
-        TACSYSLOG((LOG_ERR,"%s: socket creation error", __FUNCTION__))
-        return LIBTAC_STATUS_CONN_ERR;
+/* Creates a socket for server, non blocking and closed on exec. The
+ * socket stays non blocking for its whole life, reads and writes wait
+ * for it with poll(), see read_wait.c. Nagle is turned off: a packet
+ * is written in one go and waits for its reply, holding it back only
+ * adds a delayed ACK round.
+ *
+ * return value:
+ *   >= 0 : fd
+ *   <  0 : error, errno set
+ */
+static int _tac_socket(struct addrinfo *server) {
+    int fd;
+
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+    fd = socket(server->ai_family,
+        server->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        server->ai_protocol);
+#else
+    int err;
+
+    if ((fd = socket(server->ai_family, server->ai_socktype,
+        server->ai_protocol)) < 0)
+        return fd;
+
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) == -1
+        || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+#endif
+
+#ifdef TCP_NODELAY
+    if (fd >= 0 && server->ai_socktype == SOCK_STREAM) {
+        int on = 1;
+
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+            TACDEBUG((LOG_DEBUG, "%s: TCP_NODELAY: %m", __FUNCTION__))
+    }
+#endif
+    if (fd >= 0 && server->ai_socktype == SOCK_STREAM)
+        _tac_liveness(fd, server);
+#ifdef TCP_FASTOPEN_CONNECT
+    /* connect() then returns at once and the first write() sends
+     * the SYN with the packet in it */
+    if (fd >= 0 && tac_fastopen && server->ai_socktype == SOCK_STREAM) {
+        int on = 1;
+
+        if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on,
+            sizeof(on)) < 0)
+            TACDEBUG((LOG_DEBUG, "%s: TCP_FASTOPEN_CONNECT: %m",\
+                __FUNCTION__))
     }
+#endif
+    return fd;
+}
 
-    /* get flags for restoration later */
-    flags = fcntl(fd, F_GETFL, 0);
+/* Opens a non blocking socket to server and starts the connect.
+ *
+ * return value:
+ *   >= 0 : fd of connection in progress (or already connected)
+ *   <  0 : error status code, see LIBTAC_STATUS_..., errno set
+ */
+static int _tac_connect_start(struct addrinfo *server) {
+    int fd, err;
 
-    /* put socket in non blocking mode for timeout support */
-    if( fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ) {
-        TACSYSLOG((LOG_ERR, "%s: cannot set socket non blocking",\
-            __FUNCTION__))
+    if ((fd = _tac_socket(server)) < 0) {
+        TACSYSLOG((LOG_ERR,"%s: socket creation error: %m", __FUNCTION__))
         return LIBTAC_STATUS_CONN_ERR;
     }
 
-    rc = connect(fd, server->ai_addr, server->ai_addrlen);
     /* FIX this..for some reason errno = 0 on AIX... */
-    if((rc == -1) && (errno != EINPROGRESS) && (errno != 0)) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: connection to %s failed: %m", __FUNCTION__, ip))
+    if(connect(fd, server->ai_addr, server->ai_addrlen) == -1
+        && errno != EINPROGRESS && errno != 0) {
+        err = errno;
+        close(fd);
+        errno = err;
         return LIBTAC_STATUS_CONN_ERR;
     }
+    return fd;
+} /* _tac_connect_start */
 
-    /* set fds for select */
-    FD_ZERO(&readfds);
-    FD_ZERO(&writefds);
-    FD_SET(fd, &readfds);
-    FD_SET(fd, &writefds);
+/* Returns 1 if the connection looks usable without blocking on it: the
+ * peer has neither closed nor reset it, keepalive has not given up on
+ * it, and nothing unexpected is waiting to be read.
+ */
+int tac_alive(int fd) {
+    char c;
+    int r;
 
-    /* set timeout seconds */
-    tv.tv_sec = tac_timeout;
-    tv.tv_usec = 0;
+    if ((r = _tac_tls_alive(fd)) >= 0)
+        return r;
+    r = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
 
-    /* check if socket is ready for read and write */
-    rc = select(fd+1, &readfds, &writefds, NULL, &tv);
+/* Records a completed connect in the health table, unless it is a fast
+ * open one that has not even sent its SYN yet and so tells nothing.
+ */
+static void _tac_connected(int fd, struct addrinfo *server, int msecs) {
+#if defined(TCP_FASTOPEN_CONNECT) && defined(TCP_INFO)
+    struct tcp_info ti;
+    socklen_t len = sizeof(ti);
 
-    /* timeout */
-    if ( rc == 0 ) {
+    if (tac_fastopen
+        && getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) == 0
+        && ti.tcpi_state == TCP_SYN_SENT)
+        return;
+#endif
+    tac_health_connect(server, msecs);
+}
+
+/* return value:
+ *   >= 0 : valid fd
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+int tac_connect_single(struct addrinfo *server, char *key) {
+    long start = _tac_now_msecs();
+    int fd;
+
+    if(server == NULL) {
+        TACSYSLOG((LOG_ERR, "%s: no TACACS+ server defined", __FUNCTION__))
+        return LIBTAC_STATUS_CONN_ERR;
+    }
+
+    /* nothing left of the transaction budget, do not even try */
+    if (_tac_time_left(-1) == 0) {
+        TACDEBUG((LOG_DEBUG, "%s: deadline passed", __FUNCTION__))
         return LIBTAC_STATUS_CONN_TIMEOUT;
     }
 
-    /* some other error or interrupt before timeout */
-    if ( rc < 0 ) {
+    if ((fd = tac_connect_start(server)) < 0)
+        return fd;
+    return tac_connect_finish(fd, server, key, start);
+} /* tac_connect_single */
+
+
+/* Starts a connect to server and returns without waiting for it, so
+ * the caller can do something else meanwhile, like asking the user
+ * for the password; tac_connect_finish() completes it.
+ *
+ * return value:
+ *   >= 0 : fd of connection in progress
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+int tac_connect_start(struct addrinfo *server) {
+    char *ip;
+    int fd;
+
+    if ((fd = _tac_connect_start(server)) < 0) {
+        ip = tac_ntop(server->ai_addr, 0);
         TACSYSLOG((LOG_ERR,\
-            "%s: connection failed with %s: %m", __FUNCTION__, ip))
-        return LIBTAC_STATUS_CONN_ERR;
+            "%s: connection to %s failed: %m", __FUNCTION__, ip))
+        free(ip);
+        tac_health_connect(server, -1);
     }
+    return fd;
+} /* tac_connect_start */
 
-    /* check with getpeername if we have a valid connection */
-    len = sizeof addr;
-    if(getpeername(fd, (struct sockaddr*)&addr, &len) == -1) {
+
+/* Waits up to the server's timeout (see tac_srvtab_timeout()), within
+ * the transaction deadline, for the connect started on fd to complete,
+ * and makes key current. start is when the connect was started, used
+ * for the health table; 0 if the time taken says nothing about the
+ * server. fd is closed on failure.
+ *
+ * return value:
+ *   >= 0 : valid fd
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+int tac_connect_finish(int fd, struct addrinfo *server, char *key,
+    long start) {
+    int retval = LIBTAC_STATUS_CONN_ERR; /* default retval */
+    int rc, err, remaining;
+    struct pollfd pfd;
+    socklen_t len;
+    char *ip = NULL;
+    long deadline = _tac_now_msecs()
+        + _tac_time_left(tac_srvtab_timeout(server)*1000);
+
+    /* format server address into a string  for use in messages */
+    ip = tac_ntop(server->ai_addr, 0);
+
+    /* wait for the handshake; poll() has no limit on the fd number */
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    do {
+        remaining = deadline - _tac_now_msecs();
+        if (remaining < 0)
+            remaining = 0;
+        rc = poll(&pfd, 1, remaining);
+    } while (rc < 0 && errno == EINTR);
+
+    if ( rc == 0 ) {
+        /* timeout */
+        TACSYSLOG((LOG_ERR,\
+            "%s: connection to %s timed out", __FUNCTION__, ip))
+        tac_health_connect(server, -1);
+        retval = LIBTAC_STATUS_CONN_TIMEOUT;
+    } else if ( rc < 0 ) {
+        /* some other error before timeout */
         TACSYSLOG((LOG_ERR,\
             "%s: connection failed with %s: %m", __FUNCTION__, ip))
-        return LIBTAC_STATUS_CONN_ERR;
+    } else {
+        /* check if we have a valid connection */
+        err = 0;
+        len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+            err = errno;
+        if (err != 0) {
+            TACSYSLOG((LOG_ERR,\
+                "%s: connection failed with %s: %s", __FUNCTION__, ip,\
+                strerror(err)))
+            tac_health_connect(server, -1);
+        } else {
+            /* connected ok */
+            TACDEBUG((LOG_DEBUG, "%s: connected to %s", __FUNCTION__, ip))
+            retval = fd;
+            if (start != 0)
+                _tac_connected(fd, server, _tac_now_msecs() - start);
+
+            if (tac_tls && tac_tls_connect(&retval, &server, 1) == 0)
+                fd = -1;    /* closed by tac_tls_connect() */
+            else
+                tac_set_key(key);   /* set current tac_secret */
+        }
     }
 
-    /* restore flags on socket - flags was set only when fd >= 0 */
-    if(fcntl(fd, F_SETFL, flags) == -1) {
-        TACSYSLOG((LOG_ERR, "%s: cannot restore socket flags: %m",\
-             __FUNCTION__)) 
-        return LIBTAC_STATUS_CONN_ERR;
+    free(ip);
+
+    /* if valid fd, but error experienced after open, close fd */
+    if ( retval < 0 && fd >= 0 ) {
+        close(fd);
     }
 
-    /* connected ok */
-    TACDEBUG((LOG_DEBUG, "%s: connected to %s", __FUNCTION__, ip))
-    retval = fd;
+    TACDEBUG((LOG_DEBUG, "%s: exit status=%d (fd=%d)",\
+        __FUNCTION__, retval < 0 ? retval:0, fd))
+    return retval;
+} /* tac_connect_finish */
 
-    /* set current tac_secret */
+
+/* Makes key the current tac_secret, used for the packets that follow;
+ * called on connect, and when going back to an already open connection.
+ * Over TLS there is no key, packets are not obfuscated (see tls.c).
+ */
+void tac_set_key(char *key) {
     tac_encryption = 0;
-    if (key != NULL && *key) {
+    if (key != NULL && *key && !tac_tls) {
         tac_encryption = 1;
         tac_secret = key;
     }
+} /* tac_set_key */
 
-    free(ip);
 
-    /* if valid fd, but error experienced after open, close fd */
-    if ( fd >= 0 && retval < 0 ) {
-        close(fd);
+/* Starts connections to all servers passed in server table and returns
+ * the one that completes the handshake first; the others are closed.
+ * In the spirit of RFC 8305 ("Happy Eyeballs") the attempts are started
+ * tac_connect_delay milliseconds apart, alternating between address
+ * families, and a failed attempt starts the next one immediately. Each
+ * attempt is given the server's timeout to complete, no attempt outlives
+ * the transaction deadline.
+ *
+ * return value:
+ *   >= 0 : valid fd, index of the server in *winner
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+int tac_connect_parallel(struct addrinfo **server, char **key, int servers,
+    int *winner) {
+    int retval = LIBTAC_STATUS_CONN_TIMEOUT;
+    int *order, *fds;
+    long *deadline, *begin;
+    struct pollfd *pfd;
+    int *pfd_srv;
+    int started = 0, active = 0, won = -1;
+    int i, j, fam, rc, err;
+    long now, next_start;
+    socklen_t len;
+    char *ip;
+
+    if(servers == 0 || server == NULL) {
+        TACSYSLOG((LOG_ERR, "%s: no TACACS+ servers defined", __FUNCTION__))
+        return LIBTAC_STATUS_CONN_ERR;
     }
 
-    TACDEBUG((LOG_DEBUG, "%s: exit status=%d (fd=%d)",\
-        __FUNCTION__, retval < 0 ? retval:0, fd))
+    order = (int *) xcalloc(servers, sizeof(int));
+    fds = (int *) xcalloc(servers, sizeof(int));
+    deadline = (long *) xcalloc(servers, sizeof(long));
+    begin = (long *) xcalloc(servers, sizeof(long));
+    pfd = (struct pollfd *) xcalloc(servers, sizeof(struct pollfd));
+    pfd_srv = (int *) xcalloc(servers, sizeof(int));
+
+    /* interleave address families, keeping the order within each family */
+    for (i = 0; i < servers; i++) {
+        fds[i] = -1;
+        order[i] = -1;
+    }
+    fam = server[0]->ai_family;
+    for (i = 0; i < servers; i++) {
+        int pick = -1;
+        for (j = 0; j < servers; j++) {
+            if (fds[j] == -1 && server[j]->ai_family == fam) {
+                pick = j;
+                break;
+            }
+        }
+        if (pick < 0) {
+            for (j = 0; fds[j] != -1; j++)
+                ;
+            pick = j;
+        }
+        order[i] = pick;
+        fds[pick] = -2; /* mark as taken, fds[] is reset below */
+        fam = (server[pick]->ai_family == AF_INET6) ? AF_INET : AF_INET6;
+    }
+    for (i = 0; i < servers; i++)
+        fds[i] = -1;
+
+    next_start = _tac_now_msecs();
+    while (1) {
+        int timeout, n = 0;
+
+        now = _tac_now_msecs();
+
+        /* no new attempts once the transaction budget is spent */
+        if (started < servers && _tac_time_left(-1) == 0)
+            started = servers;
+
+        /* start the next attempt when its turn has come */
+        if (started < servers && now >= next_start) {
+            int s = order[started++];
+
+            fds[s] = _tac_connect_start(server[s]);
+            if (fds[s] >= 0) {
+                begin[s] = now;
+                deadline[s] = now
+                    + _tac_time_left(tac_srvtab_timeout(server[s])*1000);
+                active++;
+                TACDEBUG((LOG_DEBUG, "%s: attempt %d started (fd=%d)",
+                    __FUNCTION__, s, fds[s]))
+            } else {
+                retval = fds[s];
+            }
+            next_start = (fds[s] >= 0) ? now + tac_connect_delay : now;
+            continue;
+        }
+
+        /* expire attempts and build the poll set */
+        timeout = (started < servers) ? (int)(next_start - now) : -1;
+        for (i = 0; i < servers; i++) {
+            if (fds[i] < 0)
+                continue;
+            if (now >= deadline[i]) {
+                ip = tac_ntop(server[i]->ai_addr, 0);
+                TACSYSLOG((LOG_ERR, "%s: connection to %s timed out",
+                    __FUNCTION__, ip))
+                free(ip);
+                close(fds[i]);
+                fds[i] = -1;
+                active--;
+                retval = LIBTAC_STATUS_CONN_TIMEOUT;
+                tac_health_connect(server[i], -1);
+                if (started < servers)
+                    next_start = now;
+                continue;
+            }
+            if (timeout < 0 || deadline[i] - now < timeout)
+                timeout = (int)(deadline[i] - now);
+            pfd[n].fd = fds[i];
+            pfd[n].events = POLLOUT;
+            pfd[n].revents = 0;
+            pfd_srv[n] = i;
+            n++;
+        }
+
+        if (active == 0 && started == servers)
+            break;
+
+        rc = poll(pfd, n, timeout);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            TACSYSLOG((LOG_ERR, "%s: poll failed: %m", __FUNCTION__))
+            retval = LIBTAC_STATUS_CONN_ERR;
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            int s = pfd_srv[i];
+
+            if (pfd[i].revents == 0)
+                continue;
+
+            err = 0;
+            len = sizeof(err);
+            if (getsockopt(fds[s], SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+                err = errno;
+            if (err == 0) {
+                won = s;
+                _tac_connected(fds[s], server[s],
+                    _tac_now_msecs() - begin[s]);
+                break;
+            }
+
+            ip = tac_ntop(server[s]->ai_addr, 0);
+            TACSYSLOG((LOG_ERR, "%s: connection to %s failed: %s",
+                __FUNCTION__, ip, strerror(err)))
+            free(ip);
+            close(fds[s]);
+            fds[s] = -1;
+            active--;
+            retval = LIBTAC_STATUS_CONN_ERR;
+            tac_health_connect(server[s], -1);
+            /* do not wait for the delay to expire, start the next one now */
+            if (started < servers)
+                next_start = _tac_now_msecs();
+        }
+        if (won >= 0)
+            break;
+    }
+
+    /* close the attempts that lost the race */
+    for (i = 0; i < servers; i++) {
+        if (fds[i] >= 0 && i != won)
+            close(fds[i]);
+    }
+
+    if (won >= 0) {
+        retval = fds[won];
+        *winner = won;
+        if (tac_tls)
+            tac_tls_connect(&retval, &server[won], 1);
+    }
+
+    if (retval >= 0) {
+        /* set current tac_secret */
+        tac_set_key(key != NULL ? key[won] : NULL);
+
+        ip = tac_ntop(server[won]->ai_addr, 0);
+        TACDEBUG((LOG_DEBUG, "%s: connected to %s", __FUNCTION__, ip))
+        free(ip);
+    }
+
+    free(order);
+    free(fds);
+    free(deadline);
+    free(begin);
+    free(pfd);
+    free(pfd_srv);
+
+    TACDEBUG((LOG_DEBUG, "%s: exit status=%d (srv %d)",\
+        __FUNCTION__, retval < 0 ? retval : 0, won))
     return retval;
-} /* tac_connect_single */
+} /* tac_connect_parallel */
+
+/* Connects to all servers passed in server table at once, for requests
+ * that go to each of them. fd[i] gets the connection to server[i], or a
+ * negative status code if it could not be made; an fd[i] that is >= 0
+ * on entry is taken as connected already (e.g. from tac_pool_get()).
+ * Each attempt is given the server's timeout to complete, no attempt
+ * outlives the transaction deadline. No key is set, the caller does
+ * that per server.
+ *
+ * return value:
+ *   number of servers connected
+ */
+int tac_connect_all(struct addrinfo **server, int servers, int *fd) {
+    long *deadline, *begin;
+    struct pollfd *pfd;
+    int *pfd_srv;
+    int connected = 0, active = 0;
+    int i, rc, err;
+    long now;
+    socklen_t len;
+    char *ip;
+
+    deadline = (long *) xcalloc(servers + 1, sizeof(long));
+    begin = (long *) xcalloc(servers + 1, sizeof(long));
+    pfd = (struct pollfd *) xcalloc(servers + 1, sizeof(struct pollfd));
+    pfd_srv = (int *) xcalloc(servers + 1, sizeof(int));
+
+    /* start all attempts, nobody waits for anybody */
+    for (i = 0; i < servers; i++) {
+        if (fd[i] >= 0) {
+            connected++;
+            continue;
+        }
+        if (_tac_time_left(-1) == 0) {
+            fd[i] = LIBTAC_STATUS_CONN_TIMEOUT;
+            continue;
+        }
+        if ((fd[i] = tac_connect_start(server[i])) < 0)
+            continue;
+        begin[i] = _tac_now_msecs();
+        deadline[i] = begin[i]
+            + _tac_time_left(tac_srvtab_timeout(server[i])*1000);
+        active++;
+    }
+
+    while (active > 0) {
+        int timeout = -1, n = 0;
+
+        now = _tac_now_msecs();
+        for (i = 0; i < servers; i++) {
+            if (fd[i] < 0 || deadline[i] == 0)
+                continue;
+            if (now >= deadline[i]) {
+                ip = tac_ntop(server[i]->ai_addr, 0);
+                TACSYSLOG((LOG_ERR, "%s: connection to %s timed out",
+                    __FUNCTION__, ip))
+                free(ip);
+                close(fd[i]);
+                fd[i] = LIBTAC_STATUS_CONN_TIMEOUT;
+                active--;
+                tac_health_connect(server[i], -1);
+                continue;
+            }
+            if (timeout < 0 || deadline[i] - now < timeout)
+                timeout = (int)(deadline[i] - now);
+            pfd[n].fd = fd[i];
+            pfd[n].events = POLLOUT;
+            pfd[n].revents = 0;
+            pfd_srv[n] = i;
+            n++;
+        }
+        if (n == 0)
+            break;
+
+        rc = poll(pfd, n, timeout);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            TACSYSLOG((LOG_ERR, "%s: poll failed: %m", __FUNCTION__))
+            for (i = 0; i < n; i++) {
+                close(pfd[i].fd);
+                fd[pfd_srv[i]] = LIBTAC_STATUS_CONN_ERR;
+            }
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            int s = pfd_srv[i];
+
+            if (pfd[i].revents == 0)
+                continue;
+
+            deadline[s] = 0;
+            active--;
+            err = 0;
+            len = sizeof(err);
+            if (getsockopt(fd[s], SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+                err = errno;
+            if (err == 0) {
+                connected++;
+                _tac_connected(fd[s], server[s],
+                    _tac_now_msecs() - begin[s]);
+                continue;
+            }
+
+            ip = tac_ntop(server[s]->ai_addr, 0);
+            TACSYSLOG((LOG_ERR, "%s: connection to %s failed: %s",
+                __FUNCTION__, ip, strerror(err)))
+            free(ip);
+            close(fd[s]);
+            fd[s] = LIBTAC_STATUS_CONN_ERR;
+            tac_health_connect(server[s], -1);
+        }
+    }
+
+    free(deadline);
+    free(begin);
+    free(pfd);
+    free(pfd_srv);
+
+    /* the handshakes of all of them at once, too */
+    if (tac_tls && connected > 0)
+        connected = tac_tls_connect(fd, server, servers);
+
+    TACDEBUG((LOG_DEBUG, "%s: %d of %d servers connected",\
+        __FUNCTION__, connected, servers))
+    return connected;
+} /* tac_connect_all */
 
 
 /* return value:
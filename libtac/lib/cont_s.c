@@ -23,20 +23,19 @@
 #include "md5.h"
 #include "pam_tacplus.h"
 
-/* this function sends a continue packet do TACACS+ server, asking
- * for validation of given password
+/* this function builds a continue packet for TACACS+ server, asking
+ * for validation of given password; returned in *out, to be freed
+ * by caller
  *
  * return value:
- *      0 : success
+ *   >  0 : length of packet
  *   <  0 : error status code, see LIBTAC_STATUS_...
- *         LIBTAC_STATUS_WRITE_ERR
- *         LIBTAC_STATUS_WRITE_TIMEOUT  (pending impl)
  *         LIBTAC_STATUS_ASSEMBLY_ERR
  */
-int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
+int _tac_cont_pkt(int fd, char *pass, int ctrl, int seq, u_char **out) {
     HDR *th;        /* TACACS+ packet header */
     struct authen_cont tb;  /* continue body */
-    int pass_len, bodylength, w;
+    int pass_len, bodylength;
     int pkt_len = 0;
     int ret = 0;
     u_char *pkt = NULL;
@@ -47,6 +46,7 @@ int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
     th->version = TAC_PLUS_VER_0;
     th->seq_no = seq;
     th->encryption = tac_encryption ? TAC_PLUS_ENCRYPTED_FLAG : TAC_PLUS_UNENCRYPTED_FLAG;
+    th->encryption |= _tac_sconn_flags(fd);
 
     /* get size of submitted data */
     pass_len = strlen(pass);
@@ -60,16 +60,6 @@ int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
 
     th->datalength = htonl(bodylength);
 
-    /* we can now write the header */
-    w = write(fd, th, TAC_PLUS_HDR_SIZE);
-    if (w < 0 || w < TAC_PLUS_HDR_SIZE) {
-        TACSYSLOG((LOG_ERR, "%s: short write on header, wrote %d of %d: %m",\
-            __FUNCTION__, w, TAC_PLUS_HDR_SIZE))
-        free(pkt);
-        free(th);
-        return LIBTAC_STATUS_WRITE_ERR;
-    }
-
     /* build the packet */
     pkt = (u_char *) xcalloc(1, bodylength);
 
@@ -91,13 +81,8 @@ int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
     /* encrypt the body */
     _tac_crypt(pkt, th, bodylength);
 
-    w = write(fd, pkt, pkt_len);
-    if (w < 0 || w < pkt_len) {
-        TACSYSLOG((LOG_ERR,\
-            "%s: short write on body, wrote %d of %d: %m",\
-            __FUNCTION__, w, pkt_len))
-        ret=LIBTAC_STATUS_WRITE_ERR;
-    }
+    *out = _tac_pkt_join(th, pkt, pkt_len);
+    ret = TAC_PLUS_HDR_SIZE + pkt_len;
 
     /* Packet Debug (In 'debug tacacs packet' format */
     if (ctrl & PAM_TAC_PACKET_DEBUG) {
@@ -116,6 +101,28 @@ int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
     free(pkt);
     free(th);
 
+    return ret;
+} /* _tac_cont_pkt */
+
+/* this function sends a continue packet do TACACS+ server, asking
+ * for validation of given password
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *         LIBTAC_STATUS_WRITE_ERR
+ *         LIBTAC_STATUS_WRITE_TIMEOUT
+ *         LIBTAC_STATUS_ASSEMBLY_ERR
+ */
+int tac_cont_send(int fd, char *pass, int ctrl, int seq) {
+    u_char *pkt = NULL;
+    int ret;
+
+    ret = _tac_cont_pkt(fd, pass, ctrl, seq, &pkt);
+    if (ret > 0)
+        ret = _tac_write_pkt(fd, pkt, ret);
+    free(pkt);
+
     if (ctrl & PAM_TAC_DEBUG)
     	TACDEBUG((LOG_DEBUG, "%s: exit status=%d", __FUNCTION__, ret))
 
@@ -23,82 +23,211 @@
 #include "xalloc.h"
 #include "md5.h"
 
-/* Produce MD5 pseudo-random pad for TACACS+ encryption.
-   Use data from packet header and secret, which
-   should be a global variable */
-u_char *_tac_md5_pad(int len, HDR *hdr)  {
-    int n, i, bufsize;
-    int bp = 0; /* buffer pointer */
-    int pp = 0; /* pad pointer */
-    u_char *pad;
-    u_char *buf;
-    MD5_CTX mdcontext;
-
-    /* make pseudo pad */
-    n = (int)(len/16)+1;  /* number of MD5 runs */
-    bufsize = sizeof(hdr->session_id) + strlen(tac_secret) + sizeof(hdr->version)
-        + sizeof(hdr->seq_no) + MD5_LEN + 10;
-    buf = (u_char *) xcalloc(1, bufsize);
-    pad = (u_char *) xcalloc(n, MD5_LEN);
-
-    for (i=0; i<n; i++) {
-        /* MD5_1 = MD5{session_id, secret, version, seq_no}
-           MD5_2 = MD5{session_id, secret, version, seq_no, MD5_1} */
-
-        /* place session_id, key, version and seq_no in buffer */
-        bp = 0;
-        bcopy(&hdr->session_id, buf, sizeof(session_id));
-        bp += sizeof(session_id);
-        bcopy(tac_secret, buf+bp, strlen(tac_secret));
-        bp += strlen(tac_secret);
-        bcopy(&hdr->version, buf+bp, sizeof(hdr->version));
-        bp += sizeof(hdr->version);
-        bcopy(&hdr->seq_no, buf+bp, sizeof(hdr->seq_no));
-        bp += sizeof(hdr->seq_no);
-
-        /* append previous pad if this is not the first run */
-        if (i) {
-            bcopy(pad+((i-1)*MD5_LEN), buf+bp, MD5_LEN);
-            bp+=MD5_LEN;
-        }
-  
-        MD5Init(&mdcontext);
-        MD5Update(&mdcontext, buf, bp);
-        /* this is because MD5 implementation has changed between
-         * pppd versions 2.2.0g and 2.3.4
-         */
-#if 1
-        MD5Final(pad+pp, &mdcontext); /* correct for pppd-2.3.4 */
-#else
-        MD5Final(&mdcontext); /* correct for pppd-2.2.0g */
-        bcopy(&mdcontext.digest, pad+pp, MD5_LEN);
+/* The pad is XORed into the body 16, 32 or 64 bytes at a time: GCC
+ * vector types give SSE2 on any x86-64,
+ * AVX2 or AVX-512 where the CPU has them (picked at the first call),
+ * and NEON or plain code elsewhere.
+ */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define TAC_XOR_VECTOR
+#endif
+
+#if defined(TAC_XOR_VECTOR) && (defined(__x86_64__) || defined(__i386__))
+#define TAC_XOR_WIDE
+#endif
+
+#ifdef TAC_XOR_VECTOR
+/* unaligned loads and stores through memcpy, the compiler turns them
+ * into single vector moves
+ */
+#define TAC_XOR_FUNC(name, vtype, attr) \
+attr static void name(u_char *buf, const u_char *pad, int len) { \
+    vtype b, p; \
+    int i; \
+    \
+    for (i = 0; i + (int) sizeof(vtype) <= len; i += sizeof(vtype)) { \
+        memcpy(&b, buf + i, sizeof(vtype)); \
+        memcpy(&p, pad + i, sizeof(vtype)); \
+        b ^= p; \
+        memcpy(buf + i, &b, sizeof(vtype)); \
+    } \
+    for (; i < len; i++) \
+        buf[i] ^= pad[i]; \
+}
+
+typedef u_char tac_xor_v16 __attribute__((vector_size(16)));
+TAC_XOR_FUNC(_tac_xor16, tac_xor_v16, )
+
+#ifdef TAC_XOR_WIDE
+typedef u_char tac_xor_v32 __attribute__((vector_size(32)));
+typedef u_char tac_xor_v64 __attribute__((vector_size(64)));
+TAC_XOR_FUNC(_tac_xor32, tac_xor_v32, __attribute__((target("avx2"))))
+TAC_XOR_FUNC(_tac_xor64, tac_xor_v64, __attribute__((target("avx512f"))))
+#endif
+#endif /* TAC_XOR_VECTOR */
+
+/* the byte loop, the only one without vector support */
+static void _tac_xor1(u_char *buf, const u_char *pad, int len) {
+    int i;
+
+    for (i = 0; i < len; i++)
+        buf[i] ^= pad[i];
+}
+
+static void (*tac_xor)(u_char *, const u_char *, int) = NULL;
+
+/* Makes _tac_xor() go width bytes at a time: 1, 16, or 32 and 64 where
+ * the CPU has AVX2 and AVX-512; 0 goes back to the widest there is.
+ * For tests and benchmarks.
+ *
+ * return value:
+ *      0 : done
+ *     -1 : width not available here
+ */
+int _tac_xor_select(int width) {
+    switch (width) {
+        case 0:
+            tac_xor = NULL;
+            return 0;
+        case 1:
+            tac_xor = _tac_xor1;
+            return 0;
+#ifdef TAC_XOR_VECTOR
+        case 16:
+            tac_xor = _tac_xor16;
+            return 0;
+#ifdef TAC_XOR_WIDE
+        case 32:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx2"))
+                return -1;
+            tac_xor = _tac_xor32;
+            return 0;
+        case 64:
+            __builtin_cpu_init();
+            if (!__builtin_cpu_supports("avx512f"))
+                return -1;
+            tac_xor = _tac_xor64;
+            return 0;
+#endif
 #endif
-   
-        pp += MD5_LEN;
     }
+    return -1;
+}    /* _tac_xor_select */
 
-    free(buf);
-    return pad;
- 
-}    /* _tac_md5_pad */
+/* XORs len bytes of pad into buf */
+void _tac_xor(u_char *buf, const u_char *pad, int len) {
+    if (tac_xor == NULL) {
+#ifdef TAC_XOR_VECTOR
+        tac_xor = _tac_xor16;
+#ifdef TAC_XOR_WIDE
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            tac_xor = _tac_xor64;
+        else if (__builtin_cpu_supports("avx2"))
+            tac_xor = _tac_xor32;
+#endif
+#else
+        tac_xor = _tac_xor1;
+#endif
+    }
+    tac_xor(buf, pad, len);
+}    /* _tac_xor */
 
 /* Perform encryption/decryption on buffer. This means simply XORing
    each byte from buffer with according byte from pseudo-random
    pad. */
 void _tac_crypt(u_char *buf, HDR *th, int length) {
-    int i;
-    u_char *pad;
- 
     /* null operation if no encryption requested */
-    if((tac_secret != NULL) && (th->encryption == TAC_PLUS_ENCRYPTED_FLAG)) {
-        pad = _tac_md5_pad(length, th);
- 
-        for (i=0; i<length; i++) {
-            *(buf+i) ^= pad[i];
-        }
-  
-        free(pad);
-    } else {
+    if((tac_secret != NULL) && !(th->encryption & TAC_PLUS_UNENCRYPTED_FLAG)) {
+        _tac_md5()->pad(buf, length, th, tac_secret);
+    } else if (!tac_tls) {
         TACSYSLOG((LOG_WARNING, "%s: using no TACACS+ encryption", __FUNCTION__))
     }
 }    /* _tac_crypt */
+
+/* Performs _tac_crypt() on n packet bodies at once, each with its own
+ * header and key. Their pad chains do not depend on each other, so the
+ * n-th run of all of them is computed in a single multi() call of the
+ * MD5 provider (MD5Multi() for the built-in one).
+ */
+void _tac_crypt_batch(struct tac_crypt_job *job, int n) {
+    u_char **base, **msg, **digest, *arena;
+    unsigned int *plen, *len;
+    int *idx;
+    int i, k, m, off, size = 0;
+    const struct tac_md5_provider *md5 = _tac_md5();
+
+    if (n <= 0)
+        return;
+
+    base = (u_char **) xcalloc(n, sizeof(u_char *));
+    msg = (u_char **) xcalloc(n, sizeof(u_char *));
+    digest = (u_char **) xcalloc(n, sizeof(u_char *));
+    plen = (unsigned int *) xcalloc(n, sizeof(unsigned int));
+    len = (unsigned int *) xcalloc(n, sizeof(unsigned int));
+    idx = (int *) xcalloc(n, sizeof(int));
+
+    for (i = 0; i < n; i++) {
+        if (job[i].key == NULL || *job[i].key == '\0'
+            || (job[i].th->encryption & TAC_PLUS_UNENCRYPTED_FLAG)) {
+            if (!tac_tls)
+                TACSYSLOG((LOG_WARNING, "%s: using no TACACS+ encryption",\
+                    __FUNCTION__))
+            continue;
+        }
+        plen[i] = sizeof(job[i].th->session_id) + strlen(job[i].key)
+            + sizeof(job[i].th->version) + sizeof(job[i].th->seq_no);
+        size += plen[i] + MD5_LEN;
+    }
+
+    /* session_id, key, version, seq_no and room for the previous run */
+    arena = (u_char *) xcalloc(1, size + 1);
+    for (i = 0, off = 0; i < n; i++) {
+        HDR *th = job[i].th;
+        u_char *p;
+
+        if (plen[i] == 0)
+            continue;
+        p = base[i] = arena + off;
+        off += plen[i] + MD5_LEN;
+        bcopy(&th->session_id, p, sizeof(th->session_id));
+        p += sizeof(th->session_id);
+        bcopy(job[i].key, p, strlen(job[i].key));
+        p += strlen(job[i].key);
+        *p++ = th->version;
+        *p++ = th->seq_no;
+    }
+
+    for (off = 0; ; off += MD5_LEN) {
+        m = 0;
+        for (i = 0; i < n; i++) {
+            if (plen[i] == 0 || off >= job[i].len)
+                continue;
+            msg[m] = base[i];
+            len[m] = plen[i] + (off ? MD5_LEN : 0);
+            /* the run goes where the next one takes it from */
+            digest[m] = base[i] + plen[i];
+            idx[m++] = i;
+        }
+        if (m == 0)
+            break;
+
+        md5->multi(m, msg, len, digest);
+
+        for (k = 0; k < m; k++) {
+            struct tac_crypt_job *jb = &job[idx[k]];
+            int left = jb->len - off;
+
+            _tac_xor(jb->buf + off, digest[k], left < MD5_LEN ? left : MD5_LEN);
+        }
+    }
+
+    free(arena);
+    free(idx);
+    free(len);
+    free(plen);
+    free(digest);
+    free(msg);
+    free(base);
+}    /* _tac_crypt_batch */
@@ -0,0 +1,259 @@
+/* digest.c - MD5 providers: the built-in code or the system libcrypto.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <time.h>
+#if defined(HAVE_LIBCRYPTO) && defined(HAVE_OPENSSL_EVP_H)
+#include <openssl/evp.h>
+#define TAC_MD5_EVP
+#endif
+
+#include "libtac.h"
+#include "md5.h"
+
+/* All MD5 work of libtac, the encryption pad, batches of pads and the
+ * CHAP digest, goes through a provider. Which one is used is either
+ * pinned with tac_crypto_select() or, the first time MD5 is needed,
+ * the faster one in a short benchmark on this machine.
+ */
+
+/* Pad bytes made before they are XORed into the body, four MD5 runs;
+ * small enough to stay in L1, large enough for one AVX-512 XOR.
+ */
+#define TAC_PAD_CHUNK (4 * MD5_LEN)
+
+/* Applies the MD5 pseudo-random pad of hdr and key to len bytes of buf:
+ *   MD5_1 = MD5{session_id, key, version, seq_no}
+ *   MD5_n = MD5{session_id, key, version, seq_no, MD5_n-1}
+ * The prefix is hashed once per packet and the MD5 state copied for
+ * each run; the pad is made TAC_PAD_CHUNK bytes at a time and XORed
+ * into buf right away, so nothing is allocated.
+ */
+static void _tac_builtin_pad(u_char *buf, int len, HDR *hdr,
+    const char *key) {
+
+    MD5_CTX prefix, mdcontext;
+    u_char pad[TAC_PAD_CHUNK], *prev = NULL;
+    int i, j, n;
+
+    MD5Init(&prefix);
+    MD5Update(&prefix, (u_char *) &hdr->session_id, sizeof(hdr->session_id));
+    MD5Update(&prefix, (u_char *) key, strlen(key));
+    MD5Update(&prefix, &hdr->version, sizeof(hdr->version));
+    MD5Update(&prefix, &hdr->seq_no, sizeof(hdr->seq_no));
+
+    for (i = 0; i < len; i += TAC_PAD_CHUNK) {
+        n = (len - i < TAC_PAD_CHUNK) ? len - i : TAC_PAD_CHUNK;
+        for (j = 0; j < n; j += MD5_LEN) {
+            mdcontext = prefix;
+            /* append previous pad if this is not the first run */
+            if (prev != NULL)
+                MD5Update(&mdcontext, prev, MD5_LEN);
+            MD5Final(pad + j, &mdcontext);
+            prev = pad + j;
+        }
+        _tac_xor(buf + i, pad, n);
+    }
+}    /* _tac_builtin_pad */
+
+static void _tac_builtin_digest(u_char *out, u_char **part,
+    unsigned int *len, int n) {
+
+    MD5_CTX mdcontext;
+    int i;
+
+    MD5Init(&mdcontext);
+    for (i = 0; i < n; i++)
+        MD5Update(&mdcontext, part[i], len[i]);
+    MD5Final(out, &mdcontext);
+}
+
+static const struct tac_md5_provider builtin = {
+    "builtin", _tac_builtin_pad, _tac_builtin_digest, MD5Multi
+};
+
+#ifdef TAC_MD5_EVP
+static void _tac_evp_pad(u_char *buf, int len, HDR *hdr, const char *key) {
+    EVP_MD_CTX *prefix = EVP_MD_CTX_new(), *ctx = EVP_MD_CTX_new();
+    u_char pad[TAC_PAD_CHUNK], *prev = NULL;
+    unsigned int dlen;
+    int i, j, n;
+
+    EVP_DigestInit_ex(prefix, EVP_md5(), NULL);
+    EVP_DigestUpdate(prefix, &hdr->session_id, sizeof(hdr->session_id));
+    EVP_DigestUpdate(prefix, key, strlen(key));
+    EVP_DigestUpdate(prefix, &hdr->version, sizeof(hdr->version));
+    EVP_DigestUpdate(prefix, &hdr->seq_no, sizeof(hdr->seq_no));
+
+    for (i = 0; i < len; i += TAC_PAD_CHUNK) {
+        n = (len - i < TAC_PAD_CHUNK) ? len - i : TAC_PAD_CHUNK;
+        for (j = 0; j < n; j += MD5_LEN) {
+            EVP_MD_CTX_copy_ex(ctx, prefix);
+            if (prev != NULL)
+                EVP_DigestUpdate(ctx, prev, MD5_LEN);
+            EVP_DigestFinal_ex(ctx, pad + j, &dlen);
+            prev = pad + j;
+        }
+        _tac_xor(buf + i, pad, n);
+    }
+
+    EVP_MD_CTX_free(ctx);
+    EVP_MD_CTX_free(prefix);
+}
+
+static void _tac_evp_digest(u_char *out, u_char **part, unsigned int *len,
+    int n) {
+
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    u_char digest[EVP_MAX_MD_SIZE];
+    unsigned int dlen;
+    int i;
+
+    EVP_DigestInit_ex(ctx, EVP_md5(), NULL);
+    for (i = 0; i < n; i++)
+        EVP_DigestUpdate(ctx, part[i], len[i]);
+    EVP_DigestFinal_ex(ctx, digest, &dlen);
+    memcpy(out, digest, MD5_LEN);
+    EVP_MD_CTX_free(ctx);
+}
+
+/* libcrypto has no multi-buffer MD5, it hashes one message after another */
+static void _tac_evp_multi(int n, u_char **msg, unsigned int *len,
+    u_char **out) {
+
+    int i;
+
+    for (i = 0; i < n; i++)
+        _tac_evp_digest(out[i], &msg[i], &len[i], 1);
+}
+
+static const struct tac_md5_provider evp = {
+    "libcrypto", _tac_evp_pad, _tac_evp_digest, _tac_evp_multi
+};
+
+/* MD5 may be disabled in libcrypto, e.g. in FIPS mode */
+static int _tac_evp_usable(void) {
+    static const u_char abc_md5[MD5_LEN] = {
+        0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+        0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72
+    };
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    u_char digest[EVP_MAX_MD_SIZE];
+    unsigned int dlen = 0;
+    int ok;
+
+    ok = ctx != NULL && EVP_DigestInit_ex(ctx, EVP_md5(), NULL) == 1
+        && EVP_DigestUpdate(ctx, "abc", 3) == 1
+        && EVP_DigestFinal_ex(ctx, digest, &dlen) == 1
+        && dlen == MD5_LEN && !memcmp(digest, abc_md5, MD5_LEN);
+    EVP_MD_CTX_free(ctx);
+    return ok;
+}
+#endif
+
+static const struct tac_md5_provider *pinned = NULL;
+static const struct tac_md5_provider *fastest = NULL;
+
+static const struct tac_md5_provider *_tac_md5_find(const char *name) {
+    if (!strcmp(name, builtin.name))
+        return &builtin;
+#ifdef TAC_MD5_EVP
+    if (!strcmp(name, evp.name) && _tac_evp_usable())
+        return &evp;
+#endif
+    return NULL;
+}
+
+#ifdef TAC_MD5_EVP
+/* Nanoseconds the provider takes for a few 1 KB pads, the best of
+ * three tries.
+ */
+static long _tac_md5_bench(const struct tac_md5_provider *p) {
+    u_char buf[1024];
+    struct timespec t0, t1;
+    long ns, best = -1;
+    HDR th;
+    int i, k;
+
+    bzero(&th, sizeof(th));
+    bzero(buf, sizeof(buf));
+    for (k = 0; k < 3; k++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < 16; i++)
+            p->pad(buf, sizeof(buf), &th, "benchmark-secret");
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (t1.tv_sec - t0.tv_sec) * 1000000000L
+            + (t1.tv_nsec - t0.tv_nsec);
+        if (best < 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+#endif
+
+/* Pins the MD5 provider, "builtin" or "libcrypto"; NULL or "auto"
+ * goes back to the benchmark's choice.
+ *
+ * return value:
+ *      0 : provider selected
+ *     -1 : no such provider here, choosing automatically
+ */
+int tac_crypto_select(const char *name) {
+    pinned = NULL;
+    if (name == NULL || !strcmp(name, "auto"))
+        return 0;
+
+    if ((pinned = _tac_md5_find(name)) == NULL) {
+        TACSYSLOG((LOG_ERR, "%s: no crypto provider %s, choosing"\
+            " automatically", __FUNCTION__, name))
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns the MD5 provider in use */
+const struct tac_md5_provider *_tac_md5(void) {
+    if (pinned != NULL)
+        return pinned;
+
+    if (fastest == NULL) {
+        fastest = &builtin;
+#ifdef TAC_MD5_EVP
+        if (_tac_evp_usable()) {
+            long t = _tac_md5_bench(&builtin);
+            long te = _tac_md5_bench(&evp);
+
+            TACDEBUG((LOG_DEBUG, "%s: builtin %ld ns, libcrypto %ld ns",\
+                __FUNCTION__, t, te))
+            if (te < t)
+                fastest = &evp;
+        }
+#endif
+        TACDEBUG((LOG_DEBUG, "%s: using %s MD5", __FUNCTION__,\
+            fastest->name))
+    }
+    return fastest;
+}
+
+/* Returns the name of the MD5 provider in use, for the debug log */
+const char *tac_crypto_name(void) {
+    return _tac_md5()->name;
+}
@@ -34,12 +34,12 @@ char *_tac_check_header(HDR *th, int type) {
             "%s: unrelated reply, type %d, expected %d",\
             __FUNCTION__, th->type, type))
         return protocol_err_msg;
-    } /* else if(ntohl(th->session_id) != session_id) {
+    } else if(ntohl(th->session_id) != (u_int32_t) session_id) {
         TACSYSLOG((LOG_ERR,\
-            "%s: unrelated reply, received session_id %d != sent %d",\
-            __FUNCTION__, ntohl(th->session_id), session_id))
+            "%s: unrelated reply, received session_id %u != sent %u",\
+            __FUNCTION__, ntohl(th->session_id), (u_int32_t) session_id))
         return protocol_err_msg;
-    } */
+    }
     
     return NULL; /* header is ok */    
 } /* check header */
@@ -19,6 +19,8 @@
  * See `CHANGES' file for revision history.
  */
 
+#include <errno.h>
+
 #include "libtac.h"
 #include "xalloc.h"
 #include "magic.h"
@@ -77,3 +79,37 @@ HDR *_tac_req_header(u_char type, int cont_session) {
 
     return th;
 }
+
+/* Returns a packet made of header th followed by body of given
+ * length, ready to go on the wire. Caller frees it.
+ */
+u_char *_tac_pkt_join(HDR *th, u_char *body, int length) {
+    u_char *pkt;
+
+    pkt = (u_char *) xcalloc(1, TAC_PLUS_HDR_SIZE + length);
+    bcopy(th, pkt, TAC_PLUS_HDR_SIZE);
+    bcopy(body, pkt + TAC_PLUS_HDR_SIZE, length);
+    return pkt;
+}
+
+/* Writes a packet built by one of the _tac_*_pkt functions to fd.
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *         LIBTAC_STATUS_WRITE_ERR
+ *         LIBTAC_STATUS_WRITE_TIMEOUT
+ */
+int _tac_write_pkt(int fd, u_char *pkt, int length) {
+    int w;
+
+    w = tac_writen(fd, pkt, length);
+    if (w < length) {
+        TACSYSLOG((LOG_ERR,\
+            "%s: short write on packet, wrote %d of %d: %m",\
+            __FUNCTION__, w, length))
+        return errno == ETIMEDOUT ?
+            LIBTAC_STATUS_WRITE_TIMEOUT : LIBTAC_STATUS_WRITE_ERR;
+    }
+    return 0;
+}
@@ -0,0 +1,545 @@
+/* health.c - Server health and latency shared between processes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "libtac.h"
+#include "xalloc.h"
+#include "magic.h"
+
+/* The table lives in a file mapped by every process using libtac, so a
+ * server found dead by one login is skipped by the next ones instead of
+ * each of them waiting out the connect timeout again. Updates are done
+ * under an fcntl() lock on the file; a process that can't open the
+ * file for writing still uses it for ordering.
+ */
+
+/* File holding the table, NULL disables health tracking */
+char *tac_health_file = NULL;
+
+/* Seconds a failed server is skipped, doubled for each further
+ * consecutive failure up to 8 times as long */
+int tac_health_holddown = TAC_PLUS_HOLDDOWN;
+
+/* Hedged requests allowed, in percent of the requests made */
+int tac_retry_budget = TAC_PLUS_RETRY_BUDGET;
+
+/* How the server to try first is picked, TAC_BALANCE_... */
+int tac_balance = TAC_BALANCE_ORDER;
+
+#define TAC_HEALTH_MAGIC    0x54414348  /* "TACH" */
+#define TAC_HEALTH_VERSION  3
+#define TAC_HEALTH_ENTRIES  64
+
+/* the retry budget is kept in hundredths of a request */
+#define TAC_BUDGET_COST     100
+#define TAC_BUDGET_MAX      (10 * TAC_BUDGET_COST)
+
+struct tac_health_ent {
+    struct sockaddr_storage addr;
+    u_int32_t addrlen;          /* 0 for a free slot */
+    u_int32_t fails;            /* consecutive failures */
+    int64_t last_fail;          /* monotonic clock, msecs */
+    int64_t last_used;
+    u_int32_t connect_us;       /* EWMA of connect latency */
+    u_int32_t reply_us;         /* EWMA of reply latency */
+    u_int32_t reply_var_us;     /* EWMA of its mean deviation */
+    int32_t wrr;                /* weighted round-robin credit */
+};
+
+struct tac_health_tab {
+    u_int32_t magic;
+    u_int32_t version;
+    u_int32_t entries;
+    int32_t budget;             /* retry budget left */
+    struct tac_health_ent ent[TAC_HEALTH_ENTRIES];
+};
+
+static struct tac_health_tab *tab = NULL;
+static int tab_fd = -1;
+static int tab_writable = 0;
+static char *tab_file = NULL;    /* copy of the path mapped */
+
+static void _tac_health_lock(int type) {
+    struct flock fl;
+
+    bzero(&fl, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    while (fcntl(tab_fd, F_SETLKW, &fl) < 0 && errno == EINTR)
+        ;
+}
+
+static void _tac_health_close(void) {
+    if (tab != NULL)
+        munmap(tab, sizeof(struct tac_health_tab));
+    if (tab_fd >= 0)
+        close(tab_fd);
+    tab = NULL;
+    tab_fd = -1;
+    free(tab_file);
+    tab_file = NULL;
+}
+
+/* Unmaps the table when libtac goes away, e.g. when pam_end() unloads
+ * the PAM module.
+ */
+__attribute__((destructor)) static void _tac_health_fini(void) {
+    _tac_health_close();
+}
+
+/* Maps tac_health_file, creating it if needed.
+ *
+ * return value:
+ *      0 : table available
+ *   <  0 : health tracking disabled or the file can't be used
+ */
+static int _tac_health_open(void) {
+    struct stat st;
+    int prot = PROT_READ;
+
+    if (tac_health_file == NULL) {
+        _tac_health_close();
+        return -1;
+    }
+    if (tab != NULL && !strcmp(tab_file, tac_health_file))
+        return 0;
+    _tac_health_close();
+
+    tab_writable = 1;
+    tab_fd = open(tac_health_file, O_RDWR | O_CREAT, 0644);
+    if (tab_fd < 0) {
+        tab_writable = 0;
+        tab_fd = open(tac_health_file, O_RDONLY);
+    }
+    if (tab_fd < 0) {
+        TACDEBUG((LOG_DEBUG, "%s: %s: %m", __FUNCTION__, tac_health_file))
+        return -1;
+    }
+    fcntl(tab_fd, F_SETFD, FD_CLOEXEC);
+
+    if (tab_writable) {
+        prot |= PROT_WRITE;
+        _tac_health_lock(F_WRLCK);
+        if (fstat(tab_fd, &st) == 0
+            && st.st_size < (off_t) sizeof(struct tac_health_tab))
+            if (ftruncate(tab_fd, sizeof(struct tac_health_tab)) < 0)
+                TACSYSLOG((LOG_ERR, "%s: %s: %m", __FUNCTION__,\
+                    tac_health_file))
+        _tac_health_lock(F_UNLCK);
+    }
+
+    if (fstat(tab_fd, &st) < 0
+        || st.st_size < (off_t) sizeof(struct tac_health_tab)) {
+        close(tab_fd);
+        tab_fd = -1;
+        return -1;
+    }
+
+    tab = mmap(NULL, sizeof(struct tac_health_tab), prot, MAP_SHARED,
+        tab_fd, 0);
+    if (tab == MAP_FAILED) {
+        TACSYSLOG((LOG_ERR, "%s: mmap %s: %m", __FUNCTION__, tac_health_file))
+        tab = NULL;
+        close(tab_fd);
+        tab_fd = -1;
+        return -1;
+    }
+
+    if (tab_writable && (tab->magic != TAC_HEALTH_MAGIC
+        || tab->version != TAC_HEALTH_VERSION
+        || tab->entries != TAC_HEALTH_ENTRIES)) {
+        _tac_health_lock(F_WRLCK);
+        bzero(tab, sizeof(struct tac_health_tab));
+        tab->magic = TAC_HEALTH_MAGIC;
+        tab->version = TAC_HEALTH_VERSION;
+        tab->entries = TAC_HEALTH_ENTRIES;
+        tab->budget = TAC_BUDGET_MAX;
+        _tac_health_lock(F_UNLCK);
+    }
+    tab_file = xstrdup(tac_health_file);
+    return 0;
+}
+
+/* Returns the entry for addr; with create set a free or the least
+ * recently used slot is taken for it. Call with the table locked.
+ */
+static struct tac_health_ent *_tac_health_find(const struct sockaddr *addr,
+    socklen_t addrlen, int create) {
+
+    struct tac_health_ent *e, *lru = NULL;
+    int i;
+
+    if (tab->magic != TAC_HEALTH_MAGIC || addrlen > sizeof(e->addr))
+        return NULL;
+
+    for (i = 0; i < TAC_HEALTH_ENTRIES; i++) {
+        e = &tab->ent[i];
+        if (e->addrlen == addrlen && !memcmp(&e->addr, addr, addrlen))
+            return e;
+        if (lru == NULL || e->addrlen == 0
+            || (lru->addrlen != 0 && e->last_used < lru->last_used))
+            lru = e;
+    }
+    if (!create)
+        return NULL;
+
+    bzero(lru, sizeof(struct tac_health_ent));
+    bcopy(addr, &lru->addr, addrlen);
+    lru->addrlen = addrlen;
+    return lru;
+}
+
+/* Folds a sample into *avg and, if var is given, the mean deviation
+ * into *var, the way TCP estimates its round trip time (RFC 6298).
+ */
+static void _tac_health_ewma(u_int32_t *avg, u_int32_t *var, int msecs) {
+    int64_t us = (int64_t) msecs * 1000;
+    int64_t dev;
+
+    if (*avg == 0) {
+        *avg = us > 0 ? us : 1;
+        if (var != NULL)
+            *var = *avg / 2;
+        return;
+    }
+    if (var != NULL) {
+        dev = us - (int64_t) *avg;
+        if (dev < 0)
+            dev = -dev;
+        *var += (dev - (int64_t) *var) / 4;
+    }
+    *avg += (us - (int64_t) *avg) / 8;
+}
+
+/* Records the outcome of talking to the server at addr: msecs is the
+ * time it took, or negative for a failure.
+ */
+static void _tac_health_update(const struct sockaddr *addr,
+    socklen_t addrlen, int msecs, int reply) {
+
+    struct tac_health_ent *e;
+
+    if (_tac_health_open() < 0 || !tab_writable)
+        return;
+
+    _tac_health_lock(F_WRLCK);
+    if ((e = _tac_health_find(addr, addrlen, 1)) != NULL) {
+        e->last_used = _tac_now_msecs();
+        if (msecs < 0) {
+            e->fails++;
+            e->last_fail = e->last_used;
+        } else {
+            e->fails = 0;
+            if (reply)
+                _tac_health_ewma(&e->reply_us, &e->reply_var_us, msecs);
+            else
+                _tac_health_ewma(&e->connect_us, NULL, msecs);
+        }
+    }
+    _tac_health_lock(F_UNLCK);
+}
+
+/* Records a connect to server that took msecs, or failed if negative */
+void tac_health_connect(struct addrinfo *server, int msecs) {
+    _tac_health_update(server->ai_addr, server->ai_addrlen, msecs, 0);
+}
+
+/* Records a reply on fd that took msecs, or failed if negative */
+void tac_health_reply(int fd, int msecs) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (tac_health_file == NULL
+        || getpeername(fd, (struct sockaddr *) &addr, &len) < 0)
+        return;
+    _tac_health_update((struct sockaddr *) &addr, len, msecs, 1);
+}
+
+/* Returns the sort key of server: held down servers last, then by
+ * latency; servers not seen yet count as fastest so they get tried.
+ */
+static int64_t _tac_health_rank(struct addrinfo *server, int64_t now) {
+    struct tac_health_ent *e;
+    int64_t holddown;
+
+    e = _tac_health_find(server->ai_addr, server->ai_addrlen, 0);
+    if (e == NULL)
+        return 0;
+
+    if (e->fails > 0) {
+        holddown = (int64_t) tac_health_holddown * 1000
+            << (e->fails > 4 ? 3 : e->fails - 1);
+        /* last_fail in the future: the clock went back, don't trust it */
+        if (e->last_fail <= now && now - e->last_fail < holddown)
+            return ((int64_t) 1 << 40) + e->connect_us + e->reply_us;
+    }
+    return e->connect_us + e->reply_us;
+}
+
+/* Sorts the server table (and the matching keys) so that the fastest
+ * healthy server comes first and servers in hold-down come last; the
+ * configured order is kept between servers that rank equal.
+ */
+void tac_health_order(struct addrinfo **server, char **key, int servers) {
+    int64_t *rank, now;
+    int i, j;
+
+    if (servers < 2 || _tac_health_open() < 0)
+        return;
+
+    rank = (int64_t *) xcalloc(servers, sizeof(int64_t));
+    now = _tac_now_msecs();
+
+    _tac_health_lock(F_RDLCK);
+    for (i = 0; i < servers; i++)
+        rank[i] = _tac_health_rank(server[i], now);
+    _tac_health_lock(F_UNLCK);
+
+    /* insertion sort, stable and the table is tiny */
+    for (i = 1; i < servers; i++) {
+        int64_t r = rank[i];
+        struct addrinfo *s = server[i];
+        char *k = key[i];
+
+        for (j = i; j > 0 && rank[j-1] > r; j--) {
+            rank[j] = rank[j-1];
+            server[j] = server[j-1];
+            key[j] = key[j-1];
+        }
+        rank[j] = r;
+        server[j] = s;
+        key[j] = k;
+    }
+
+    if (rank[0] >= ((int64_t) 1 << 40))
+        TACDEBUG((LOG_DEBUG, "%s: all servers in hold-down", __FUNCTION__))
+    free(rank);
+}
+
+/* Moves server[i] and its key to the front, the others keep their order */
+static void _tac_health_front(struct addrinfo **server, char **key, int i) {
+    struct addrinfo *s = server[i];
+    char *k = key[i];
+
+    for (; i > 0; i--) {
+        server[i] = server[i-1];
+        key[i] = key[i-1];
+    }
+    server[0] = s;
+    key[0] = k;
+}
+
+/* Smooth weighted round-robin: every pick each server earns its weight
+ * in credit, the one with most credit is picked and pays the total.
+ * The credit is kept in the table, so all processes take turns
+ * together; without it the pick is weighted at random.
+ */
+static int _tac_balance_wrr(struct addrinfo **server, int servers) {
+    struct tac_health_ent *e, *best = NULL;
+    int i, w, total = 0, pick = 0;
+
+    if (tab != NULL && tab_writable) {
+        _tac_health_lock(F_WRLCK);
+        for (i = 0; i < servers; i++) {
+            e = _tac_health_find(server[i]->ai_addr, server[i]->ai_addrlen, 1);
+            if (e == NULL)
+                continue;
+            w = tac_srvtab_weight(server[i]);
+            e->wrr += w;
+            total += w;
+            if (best == NULL || e->wrr > best->wrr) {
+                best = e;
+                pick = i;
+            }
+        }
+        if (best != NULL)
+            best->wrr -= total;
+        _tac_health_lock(F_UNLCK);
+        if (best != NULL)
+            return pick;
+        total = 0;
+    }
+
+    for (i = 0; i < servers; i++)
+        total += tac_srvtab_weight(server[i]);
+    w = magic() % total;
+    for (pick = 0; w >= tac_srvtab_weight(server[pick]); pick++)
+        w -= tac_srvtab_weight(server[pick]);
+    return pick;
+}
+
+/* Power of two choices: of two servers picked at random the one with
+ * the lower connect plus reply latency.
+ */
+static int _tac_balance_p2c(struct addrinfo **server, int servers) {
+    int a, b;
+    int64_t now = _tac_now_msecs(), ra = 0, rb = 0;
+
+    a = magic() % servers;
+    b = magic() % (servers - 1);
+    if (b >= a)
+        b++;
+
+    if (tab != NULL) {
+        _tac_health_lock(F_RDLCK);
+        ra = _tac_health_rank(server[a], now);
+        rb = _tac_health_rank(server[b], now);
+        _tac_health_lock(F_UNLCK);
+    }
+    return rb < ra ? b : a;
+}
+
+static u_int64_t _tac_fnv1a(u_int64_t h, const void *buf, size_t len) {
+    const u_char *p = buf;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Rendezvous hashing: each server draws weight numbers from a hash of
+ * the user and its address, the highest draw wins. A user stays on
+ * the same server as long as it is up, and when one goes away only its
+ * users move.
+ */
+static int _tac_balance_user(struct addrinfo **server, int servers,
+    const char *user) {
+
+    u_int64_t h, u, best = 0;
+    int i, k, pick = 0;
+
+    u = _tac_fnv1a(0xcbf29ce484222325ULL, user, strlen(user));
+    for (i = 0; i < servers; i++) {
+        h = _tac_fnv1a(u, server[i]->ai_addr, server[i]->ai_addrlen);
+        for (k = 0; k < tac_srvtab_weight(server[i]); k++) {
+            u_char draw = k;
+            u_int64_t d = _tac_fnv1a(h, &draw, 1);
+
+            if (d > best) {
+                best = d;
+                pick = i;
+            }
+        }
+    }
+    return pick;
+}
+
+/* Picks the server to try first according to tac_balance and moves it
+ * to the front of the table; the others stay in order for failover.
+ * Only servers not in hold-down are picked, so call this after
+ * tac_health_order(). user is the user name for TAC_BALANCE_USER.
+ */
+void tac_health_balance(struct addrinfo **server, char **key, int servers,
+    const char *user) {
+
+    int64_t now = _tac_now_msecs();
+    int healthy = servers, pick = 0;
+
+    if (tac_balance == TAC_BALANCE_ORDER || servers < 2)
+        return;
+
+    if (_tac_health_open() == 0) {
+        _tac_health_lock(F_RDLCK);
+        while (healthy > 0
+            && _tac_health_rank(server[healthy-1], now) >= ((int64_t) 1 << 40))
+            healthy--;
+        _tac_health_lock(F_UNLCK);
+    }
+    if (healthy < 2)
+        return;
+
+    switch (tac_balance) {
+        case TAC_BALANCE_WRR:
+            pick = _tac_balance_wrr(server, healthy);
+            break;
+        case TAC_BALANCE_P2C:
+            pick = _tac_balance_p2c(server, healthy);
+            break;
+        case TAC_BALANCE_USER:
+            if (user != NULL && *user != '\0')
+                pick = _tac_balance_user(server, healthy, user);
+            break;
+    }
+    if (pick > 0) {
+        TACDEBUG((LOG_DEBUG, "%s: starting with server %d", __FUNCTION__,\
+            pick))
+        _tac_health_front(server, key, pick);
+    }
+}
+
+/* Returns how long a reply from server may take before it is unusually
+ * late, the smoothed reply time plus four deviations, or -1 if there
+ * are no samples for it yet.
+ */
+int tac_health_reply_limit(struct addrinfo *server) {
+    struct tac_health_ent *e;
+    int limit = -1;
+
+    if (_tac_health_open() < 0)
+        return -1;
+
+    _tac_health_lock(F_RDLCK);
+    e = _tac_health_find(server->ai_addr, server->ai_addrlen, 0);
+    if (e != NULL && e->reply_us != 0)
+        limit = (e->reply_us + 4 * e->reply_var_us) / 1000 + 1;
+    _tac_health_lock(F_UNLCK);
+    return limit;
+}
+
+/* The retry budget bounds hedged requests across all processes: every
+ * request earns tac_retry_budget hundredths of a retry, every hedge
+ * spends a whole one, so in an outage the extra load stays within
+ * tac_retry_budget percent.
+ */
+void tac_health_budget_earn(void) {
+    if (_tac_health_open() < 0 || !tab_writable)
+        return;
+
+    _tac_health_lock(F_WRLCK);
+    tab->budget += tac_retry_budget;
+    if (tab->budget > TAC_BUDGET_MAX)
+        tab->budget = TAC_BUDGET_MAX;
+    _tac_health_lock(F_UNLCK);
+}
+
+/* Takes one retry out of the budget.
+ *
+ * return value:
+ *      1 : granted
+ *      0 : budget exhausted, or no health table to keep it in
+ */
+int tac_health_budget_spend(void) {
+    int granted = 0;
+
+    if (_tac_health_open() < 0 || !tab_writable)
+        return 0;
+
+    _tac_health_lock(F_WRLCK);
+    if (tab->budget >= TAC_BUDGET_COST) {
+        tab->budget -= TAC_BUDGET_COST;
+        granted = 1;
+    }
+    _tac_health_lock(F_UNLCK);
+    return granted;
+}
@@ -24,6 +24,44 @@
 /* forward declaration */
 static void Transform __P((UINT4 *buf, UINT4 *in));
 
+/* MD5 words are little-endian; on such hosts a block is its own word
+ * array and only needs copying out of a possibly unaligned buffer.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MD5_LITTLE_ENDIAN
+#endif
+
+/* Decode turns len bytes of input into len/4 words */
+static void Decode (UINT4 *out, const unsigned char *in, unsigned int len) {
+#ifdef MD5_LITTLE_ENDIAN
+    memcpy(out, in, len);
+#else
+    unsigned int i, ii;
+
+    for (i = 0, ii = 0; ii < len; i++, ii += 4)
+        out[i] = (((UINT4)in[ii+3]) << 24) |
+            (((UINT4)in[ii+2]) << 16) |
+            (((UINT4)in[ii+1]) << 8) |
+            ((UINT4)in[ii]);
+#endif
+}
+
+/* Encode turns len/4 words into len bytes of output */
+static void Encode (unsigned char *out, const UINT4 *in, unsigned int len) {
+#ifdef MD5_LITTLE_ENDIAN
+    memcpy(out, in, len);
+#else
+    unsigned int i, ii;
+
+    for (i = 0, ii = 0; ii < len; i++, ii += 4) {
+        out[ii] = (unsigned char)(in[i] & 0xFF);
+        out[ii+1] = (unsigned char)((in[i] >> 8) & 0xFF);
+        out[ii+2] = (unsigned char)((in[i] >> 16) & 0xFF);
+        out[ii+3] = (unsigned char)((in[i] >> 24) & 0xFF);
+    }
+#endif
+}
+
 static unsigned char PADDING[64] = {
     0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -35,9 +73,10 @@ static unsigned char PADDING[64] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-/* F, G, H and I are basic MD5 functions */
-#define F(x, y, z) (((x) & (y)) | ((~x) & (z)))
-#define G(x, y, z) (((x) & (z)) | ((y) & (~z)))
+/* F, G, H and I are basic MD5 functions; F and G in the forms with
+   one operation less, same results */
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
 #define H(x, y, z) ((x) ^ (y) ^ (z))
 #define I(x, y, z) ((y) ^ ((x) | (~z)))
 
@@ -88,17 +127,17 @@ void MD5Init (MD5_CTX *mdContext) {
 
 /* The routine MD5Update updates the message-digest context to
    account for the presence of each of the characters inBuf[0..inLen-1]
-   in the message whose digest is being computed.
+   in the message whose digest is being computed. Whole blocks are
+   transformed straight from inBuf, only a partial block is buffered.
  */
 void MD5Update ( MD5_CTX *mdContext, unsigned char *inBuf,
     unsigned int inLen) {
 
     UINT4 in[16];
-    int mdi;
-    unsigned int i, ii;
+    unsigned int mdi, n;
 
     /* compute number of bytes mod 64 */
-    mdi = (int)((mdContext->i[0] >> 3) & 0x3F);
+    mdi = (unsigned int)((mdContext->i[0] >> 3) & 0x3F);
 
     /* update number of bits */
     if ((mdContext->i[0] + ((UINT4)inLen << 3)) < mdContext->i[0])
@@ -106,21 +145,28 @@ void MD5Update ( MD5_CTX *mdContext, unsigned char *inBuf,
     mdContext->i[0] += ((UINT4)inLen << 3);
     mdContext->i[1] += ((UINT4)inLen >> 29);
 
-    while (inLen--) {
-        /* add new character to buffer, increment mdi */
-        mdContext->in[mdi++] = *inBuf++;
-
-        /* transform if necessary */
-        if (mdi == 0x40) {
-            for (i = 0, ii = 0; i < 16; i++, ii += 4)
-                in[i] = (((UINT4)mdContext->in[ii+3]) << 24) |
-                    (((UINT4)mdContext->in[ii+2]) << 16) |
-                    (((UINT4)mdContext->in[ii+1]) << 8) |
-                    ((UINT4)mdContext->in[ii]);
-            Transform (mdContext->buf, in);
-            mdi = 0;
+    /* complete the buffered block first */
+    if (mdi > 0) {
+        n = 64 - mdi;
+        if (inLen < n) {
+            memcpy(mdContext->in + mdi, inBuf, inLen);
+            return;
         }
+        memcpy(mdContext->in + mdi, inBuf, n);
+        Decode (in, mdContext->in, 64);
+        Transform (mdContext->buf, in);
+        inBuf += n;
+        inLen -= n;
     }
+
+    for (; inLen >= 64; inBuf += 64, inLen -= 64) {
+        Decode (in, inBuf, 64);
+        Transform (mdContext->buf, in);
+    }
+
+    /* keep the rest for later */
+    if (inLen > 0)
+        memcpy(mdContext->in, inBuf, inLen);
 }
 
 /* The routine MD5Final terminates the message-digest computation and
@@ -129,7 +175,6 @@ void MD5Update ( MD5_CTX *mdContext, unsigned char *inBuf,
 void MD5Final (unsigned char hash[], MD5_CTX *mdContext) {
     UINT4 in[16];
     int mdi;
-    unsigned int i, ii;
     unsigned int padLen;
 
     /* save number of bits */
@@ -144,23 +189,11 @@ void MD5Final (unsigned char hash[], MD5_CTX *mdContext) {
     MD5Update (mdContext, PADDING, padLen);
 
     /* append length in bits and transform */
-    for (i = 0, ii = 0; i < 14; i++, ii += 4)
-        in[i] = (((UINT4)mdContext->in[ii+3]) << 24) |
-            (((UINT4)mdContext->in[ii+2]) << 16) |
-            (((UINT4)mdContext->in[ii+1]) << 8) |
-            ((UINT4)mdContext->in[ii]);
-        Transform (mdContext->buf, in);
+    Decode (in, mdContext->in, 56);
+    Transform (mdContext->buf, in);
 
     /* store buffer in digest */
-    for (i = 0, ii = 0; i < 4; i++, ii += 4) {
-        mdContext->digest[ii] = (unsigned char)(mdContext->buf[i] & 0xFF);
-        mdContext->digest[ii+1] =
-            (unsigned char)((mdContext->buf[i] >> 8) & 0xFF);
-        mdContext->digest[ii+2] =
-            (unsigned char)((mdContext->buf[i] >> 16) & 0xFF);
-        mdContext->digest[ii+3] =
-            (unsigned char)((mdContext->buf[i] >> 24) & 0xFF);
-    }
+    Encode (mdContext->digest, mdContext->buf, 16);
     memcpy(hash, mdContext->digest, 16);
 }
 
@@ -37,6 +37,8 @@ __BEGIN_DECLS
 void MD5Init __P((MD5_CTX*));
 void MD5Update __P((MD5_CTX*, unsigned char*, UINT4));
 void MD5Final __P((unsigned char[], MD5_CTX*));
+void MD5Multi __P((int, unsigned char**, unsigned int*, unsigned char**));
+int MD5MultiLanes __P((int));
 __END_DECLS
 
 #define MD5_LEN 16
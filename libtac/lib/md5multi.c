@@ -0,0 +1,300 @@
+/* md5multi.c - MD5 of several independent messages at once.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <string.h>
+#include "md5.h"
+
+/* A single MD5 is a chain of dependent steps and keeps a vector unit
+ * idle; the digests of independent messages are computed side by side
+ * instead, one message per 32-bit lane. The lanes are GCC vector types,
+ * so the compiler emits SSE2 (4 lanes) on any x86-64, AVX2 (8 lanes)
+ * where the CPU has it, and NEON or plain code elsewhere; without
+ * vector support everything goes through MD5Init/Update/Final.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#define MD5_MULTI_VECTOR
+#endif
+
+#if defined(MD5_MULTI_VECTOR) && (defined(__x86_64__) || defined(__i386__))
+#define MD5_MULTI_AVX2
+#endif
+
+/* Per-message view used by the lane code: whole blocks come straight
+ * from the message, the last one or two, with the padding and the
+ * length, from tail.
+ */
+struct md5_lane {
+    const unsigned char *msg;
+    unsigned int full;              /* whole 64 byte blocks in msg */
+    unsigned int blocks;            /* full plus 1 or 2 tail blocks */
+    unsigned char tail[128];
+};
+
+static int md5_lanes = -1;    /* see MD5MultiLanes() */
+
+static void _md5_lane_init(struct md5_lane *l, const unsigned char *msg,
+    unsigned int len) {
+
+    unsigned int rest = len % 64;
+    UINT4 bits_lo = (UINT4)len << 3, bits_hi = (UINT4)(len >> 29);
+    unsigned int tlen = (rest < 56) ? 64 : 128;
+
+    l->msg = msg;
+    l->full = len / 64;
+    l->blocks = l->full + tlen / 64;
+    memset(l->tail, 0, tlen);
+    memcpy(l->tail, msg + l->full * 64, rest);
+    l->tail[rest] = 0x80;
+    l->tail[tlen-8] = (unsigned char)bits_lo;
+    l->tail[tlen-7] = (unsigned char)(bits_lo >> 8);
+    l->tail[tlen-6] = (unsigned char)(bits_lo >> 16);
+    l->tail[tlen-5] = (unsigned char)(bits_lo >> 24);
+    l->tail[tlen-4] = (unsigned char)bits_hi;
+    l->tail[tlen-3] = (unsigned char)(bits_hi >> 8);
+    l->tail[tlen-2] = (unsigned char)(bits_hi >> 16);
+    l->tail[tlen-1] = (unsigned char)(bits_hi >> 24);
+}
+
+static const unsigned char *_md5_lane_block(struct md5_lane *l,
+    unsigned int b) {
+
+    return b < l->full ? l->msg + b * 64 : l->tail + (b - l->full) * 64;
+}
+
+static UINT4 _md5_word(const unsigned char *p) {
+    return ((UINT4)p[3] << 24) | ((UINT4)p[2] << 16)
+        | ((UINT4)p[1] << 8) | (UINT4)p[0];
+}
+
+#ifdef MD5_MULTI_VECTOR
+
+/* same steps as Transform() in md5.c, on vectors of lanes */
+#define MF(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MG(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MH(x, y, z) ((x) ^ (y) ^ (z))
+#define MI(x, y, z) ((y) ^ ((x) | ~(z)))
+#define MSTEP(f, a, b, c, d, x, s, ac) \
+    { (a) += f((b), (c), (d)) + (x) + (UINT4)(ac); \
+      (a) = ((a) << (s)) | ((a) >> (32 - (s))); \
+      (a) += (b); }
+
+#define MD5_ROUNDS(a, b, c, d, w) \
+    MSTEP(MF, a, b, c, d, w[ 0],  7, 0xd76aa478U) \
+    MSTEP(MF, d, a, b, c, w[ 1], 12, 0xe8c7b756U) \
+    MSTEP(MF, c, d, a, b, w[ 2], 17, 0x242070dbU) \
+    MSTEP(MF, b, c, d, a, w[ 3], 22, 0xc1bdceeeU) \
+    MSTEP(MF, a, b, c, d, w[ 4],  7, 0xf57c0fafU) \
+    MSTEP(MF, d, a, b, c, w[ 5], 12, 0x4787c62aU) \
+    MSTEP(MF, c, d, a, b, w[ 6], 17, 0xa8304613U) \
+    MSTEP(MF, b, c, d, a, w[ 7], 22, 0xfd469501U) \
+    MSTEP(MF, a, b, c, d, w[ 8],  7, 0x698098d8U) \
+    MSTEP(MF, d, a, b, c, w[ 9], 12, 0x8b44f7afU) \
+    MSTEP(MF, c, d, a, b, w[10], 17, 0xffff5bb1U) \
+    MSTEP(MF, b, c, d, a, w[11], 22, 0x895cd7beU) \
+    MSTEP(MF, a, b, c, d, w[12],  7, 0x6b901122U) \
+    MSTEP(MF, d, a, b, c, w[13], 12, 0xfd987193U) \
+    MSTEP(MF, c, d, a, b, w[14], 17, 0xa679438eU) \
+    MSTEP(MF, b, c, d, a, w[15], 22, 0x49b40821U) \
+    MSTEP(MG, a, b, c, d, w[ 1],  5, 0xf61e2562U) \
+    MSTEP(MG, d, a, b, c, w[ 6],  9, 0xc040b340U) \
+    MSTEP(MG, c, d, a, b, w[11], 14, 0x265e5a51U) \
+    MSTEP(MG, b, c, d, a, w[ 0], 20, 0xe9b6c7aaU) \
+    MSTEP(MG, a, b, c, d, w[ 5],  5, 0xd62f105dU) \
+    MSTEP(MG, d, a, b, c, w[10],  9, 0x02441453U) \
+    MSTEP(MG, c, d, a, b, w[15], 14, 0xd8a1e681U) \
+    MSTEP(MG, b, c, d, a, w[ 4], 20, 0xe7d3fbc8U) \
+    MSTEP(MG, a, b, c, d, w[ 9],  5, 0x21e1cde6U) \
+    MSTEP(MG, d, a, b, c, w[14],  9, 0xc33707d6U) \
+    MSTEP(MG, c, d, a, b, w[ 3], 14, 0xf4d50d87U) \
+    MSTEP(MG, b, c, d, a, w[ 8], 20, 0x455a14edU) \
+    MSTEP(MG, a, b, c, d, w[13],  5, 0xa9e3e905U) \
+    MSTEP(MG, d, a, b, c, w[ 2],  9, 0xfcefa3f8U) \
+    MSTEP(MG, c, d, a, b, w[ 7], 14, 0x676f02d9U) \
+    MSTEP(MG, b, c, d, a, w[12], 20, 0x8d2a4c8aU) \
+    MSTEP(MH, a, b, c, d, w[ 5],  4, 0xfffa3942U) \
+    MSTEP(MH, d, a, b, c, w[ 8], 11, 0x8771f681U) \
+    MSTEP(MH, c, d, a, b, w[11], 16, 0x6d9d6122U) \
+    MSTEP(MH, b, c, d, a, w[14], 23, 0xfde5380cU) \
+    MSTEP(MH, a, b, c, d, w[ 1],  4, 0xa4beea44U) \
+    MSTEP(MH, d, a, b, c, w[ 4], 11, 0x4bdecfa9U) \
+    MSTEP(MH, c, d, a, b, w[ 7], 16, 0xf6bb4b60U) \
+    MSTEP(MH, b, c, d, a, w[10], 23, 0xbebfbc70U) \
+    MSTEP(MH, a, b, c, d, w[13],  4, 0x289b7ec6U) \
+    MSTEP(MH, d, a, b, c, w[ 0], 11, 0xeaa127faU) \
+    MSTEP(MH, c, d, a, b, w[ 3], 16, 0xd4ef3085U) \
+    MSTEP(MH, b, c, d, a, w[ 6], 23, 0x04881d05U) \
+    MSTEP(MH, a, b, c, d, w[ 9],  4, 0xd9d4d039U) \
+    MSTEP(MH, d, a, b, c, w[12], 11, 0xe6db99e5U) \
+    MSTEP(MH, c, d, a, b, w[15], 16, 0x1fa27cf8U) \
+    MSTEP(MH, b, c, d, a, w[ 2], 23, 0xc4ac5665U) \
+    MSTEP(MI, a, b, c, d, w[ 0],  6, 0xf4292244U) \
+    MSTEP(MI, d, a, b, c, w[ 7], 10, 0x432aff97U) \
+    MSTEP(MI, c, d, a, b, w[14], 15, 0xab9423a7U) \
+    MSTEP(MI, b, c, d, a, w[ 5], 21, 0xfc93a039U) \
+    MSTEP(MI, a, b, c, d, w[12],  6, 0x655b59c3U) \
+    MSTEP(MI, d, a, b, c, w[ 3], 10, 0x8f0ccc92U) \
+    MSTEP(MI, c, d, a, b, w[10], 15, 0xffeff47dU) \
+    MSTEP(MI, b, c, d, a, w[ 1], 21, 0x85845dd1U) \
+    MSTEP(MI, a, b, c, d, w[ 8],  6, 0x6fa87e4fU) \
+    MSTEP(MI, d, a, b, c, w[15], 10, 0xfe2ce6e0U) \
+    MSTEP(MI, c, d, a, b, w[ 6], 15, 0xa3014314U) \
+    MSTEP(MI, b, c, d, a, w[13], 21, 0x4e0811a1U) \
+    MSTEP(MI, a, b, c, d, w[ 4],  6, 0xf7537e82U) \
+    MSTEP(MI, d, a, b, c, w[11], 10, 0xbd3af235U) \
+    MSTEP(MI, c, d, a, b, w[ 2], 15, 0x2ad7d2bbU) \
+    MSTEP(MI, b, c, d, a, w[ 9], 21, 0xeb86d391U)
+
+/* Defines a function hashing up to LANES messages of lane[] in vectors
+ * of type VT. Lanes whose message has run out of blocks still go
+ * through the steps, their result is masked out.
+ */
+#define MD5_LANES_FUNC(NAME, VT, LANES, ATTR) \
+ATTR static void NAME(struct md5_lane *lane, int n, unsigned char **digest) { \
+    VT a, b, c, d, sa, sb, sc, sd, mask, w[16]; \
+    unsigned int blk, max = 0; \
+    int i, j; \
+    \
+    for (i = 0; i < n; i++) \
+        if (lane[i].blocks > max) \
+            max = lane[i].blocks; \
+    for (i = 0; i < LANES; i++) { \
+        sa[i] = 0x67452301U; \
+        sb[i] = 0xefcdab89U; \
+        sc[i] = 0x98badcfeU; \
+        sd[i] = 0x10325476U; \
+    } \
+    \
+    for (blk = 0; blk < max; blk++) { \
+        for (i = 0; i < LANES; i++) { \
+            const unsigned char *p; \
+            \
+            mask[i] = (i < n && blk < lane[i].blocks) ? 0xffffffffU : 0; \
+            p = mask[i] ? _md5_lane_block(&lane[i], blk) : lane[0].tail; \
+            for (j = 0; j < 16; j++) \
+                w[j][i] = _md5_word(p + 4 * j); \
+        } \
+        a = sa; b = sb; c = sc; d = sd; \
+        MD5_ROUNDS(a, b, c, d, w) \
+        sa += a & mask; \
+        sb += b & mask; \
+        sc += c & mask; \
+        sd += d & mask; \
+    } \
+    \
+    for (i = 0; i < n; i++) { \
+        UINT4 st[4]; \
+        \
+        st[0] = sa[i]; st[1] = sb[i]; st[2] = sc[i]; st[3] = sd[i]; \
+        for (j = 0; j < 16; j++) \
+            digest[i][j] = (unsigned char)(st[j / 4] >> (8 * (j % 4))); \
+    } \
+}
+
+typedef UINT4 md5_v4 __attribute__((vector_size(16)));
+MD5_LANES_FUNC(_md5_lanes4, md5_v4, 4, )
+
+#ifdef MD5_MULTI_AVX2
+typedef UINT4 md5_v8 __attribute__((vector_size(32)));
+MD5_LANES_FUNC(_md5_lanes8, md5_v8, 8, __attribute__((target("avx2"))))
+
+static int _md5_have_avx2(void) {
+    static int have = -1;
+
+    if (have < 0) {
+        __builtin_cpu_init();
+        have = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return have;
+}
+#endif
+
+#endif /* MD5_MULTI_VECTOR */
+
+/* Makes MD5Multi() compute lanes digests side by side: 4, 8 where the
+ * CPU has AVX2, 0 for one after the other or -1 for the widest there
+ * is, the default. For tests and benchmarks.
+ *
+ * return value:
+ *      0 : done
+ *     -1 : lanes not available here
+ */
+int MD5MultiLanes (int lanes) {
+    switch (lanes) {
+        case -1:
+        case 0:
+            break;
+#ifdef MD5_MULTI_VECTOR
+        case 4:
+            break;
+#ifdef MD5_MULTI_AVX2
+        case 8:
+            if (!_md5_have_avx2())
+                return -1;
+            break;
+#endif
+#endif
+        default:
+            return -1;
+    }
+    md5_lanes = lanes;
+    return 0;
+}    /* MD5MultiLanes */
+
+/* Computes the MD5 digests of n independent messages, msg[i] of len[i]
+ * bytes, into digest[i]. A digest may overwrite its own message, all
+ * of it is read before the digest is stored.
+ */
+void MD5Multi (int n, unsigned char **msg, unsigned int *len,
+    unsigned char **digest) {
+
+    int i = 0;
+#ifdef MD5_MULTI_VECTOR
+    struct md5_lane lane[8];
+    int k, lanes = md5_lanes;
+
+    if (lanes < 0) {
+        lanes = 4;
+#ifdef MD5_MULTI_AVX2
+        if (_md5_have_avx2())
+            lanes = 8;
+#endif
+    }
+    for (; lanes > 0 && i + 1 < n; i += lanes) {
+        int m = (n - i < lanes) ? n - i : lanes;
+
+        for (k = 0; k < m; k++)
+            _md5_lane_init(&lane[k], msg[i+k], len[i+k]);
+#ifdef MD5_MULTI_AVX2
+        if (lanes == 8)
+            _md5_lanes8(lane, m, digest + i);
+        else
+#endif
+            _md5_lanes4(lane, m, digest + i);
+    }
+#endif
+
+    /* a single message left over, or all of them without vectors */
+    for (; i < n; i++) {
+        MD5_CTX ctx;
+
+        MD5Init(&ctx);
+        MD5Update(&ctx, msg[i], len[i]);
+        MD5Final(digest[i], &ctx);
+    }
+}    /* MD5Multi */
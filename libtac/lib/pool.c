@@ -0,0 +1,174 @@
+/* pool.c - Pool of idle single-connection mode connections.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <time.h>
+
+#include "libtac.h"
+#include "xalloc.h"
+
+/* Seconds an idle connection is kept in the pool, 0 disables pooling */
+int tac_pool_idle = TAC_PLUS_POOL_IDLE;
+
+struct tac_pool_ent {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    char *key;
+    int fd;
+    pid_t pid;          /* owner, fds inherited over fork() are not used */
+    time_t last_used;
+    struct tac_pool_ent *next;
+};
+
+static struct tac_pool_ent *pool = NULL;
+
+static time_t _tac_pool_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void _tac_pool_drop(struct tac_pool_ent **ep) {
+    struct tac_pool_ent *e = *ep;
+
+    *ep = e->next;
+    if (e->pid == getpid()) {
+        tac_close(e->fd);
+    } else {
+        /* inherited over fork(): nothing may be sent to the server */
+        _tac_sconn_drop(e->fd);
+        _tac_tls_close(e->fd, 0);
+        close(e->fd);
+    }
+    free(e->key);
+    free(e);
+}
+
+/* Closes the pooled connections when libtac goes away, e.g. when
+ * pam_end() unloads the PAM module and nothing can reach their fds any
+ * more.
+ */
+__attribute__((destructor)) static void _tac_pool_fini(void) {
+    while (pool != NULL)
+        _tac_pool_drop(&pool);
+}
+
+/* Closes connections that have been idle longer than tac_pool_idle and
+ * the ones the server closed or keepalive found dead meanwhile, so the
+ * next request goes straight to a good one.
+ */
+void tac_pool_reap(void) {
+    struct tac_pool_ent **ep = &pool;
+    time_t now = _tac_pool_now();
+
+    while (*ep != NULL) {
+        if (now - (*ep)->last_used >= tac_pool_idle
+            || (*ep)->pid != getpid()) {
+            TACDEBUG((LOG_DEBUG, "%s: closing idle fd=%d", __FUNCTION__,\
+                (*ep)->fd))
+            _tac_pool_drop(ep);
+        } else if (!tac_alive((*ep)->fd)) {
+            TACDEBUG((LOG_DEBUG, "%s: closing dead fd=%d", __FUNCTION__,\
+                (*ep)->fd))
+            _tac_pool_drop(ep);
+        } else {
+            ep = &(*ep)->next;
+        }
+    }
+}
+
+/* Takes an idle connection to server using key out of the pool and
+ * makes key the current secret.
+ *
+ * return value:
+ *   >= 0 : valid fd
+ *   <  0 : no live connection in the pool
+ */
+int tac_pool_get(struct addrinfo *server, char *key) {
+    struct tac_pool_ent **ep;
+    int fd;
+
+    tac_pool_reap();
+
+    for (ep = &pool; *ep != NULL; ) {
+        struct tac_pool_ent *e = *ep;
+
+        if (e->addrlen != server->ai_addrlen
+            || memcmp(&e->addr, server->ai_addr, e->addrlen) != 0
+            || strcmp(e->key, key != NULL ? key : "") != 0) {
+            ep = &e->next;
+            continue;
+        }
+
+        if (!tac_alive(e->fd)) {
+            TACDEBUG((LOG_DEBUG, "%s: pooled fd=%d is dead", __FUNCTION__,\
+                e->fd))
+            _tac_pool_drop(ep);
+            continue;
+        }
+
+        fd = e->fd;
+        *ep = e->next;
+        free(e->key);
+        free(e);
+
+        tac_set_key(key);
+        TACDEBUG((LOG_DEBUG, "%s: reusing fd=%d", __FUNCTION__, fd))
+        return fd;
+    }
+    return -1;
+}
+
+/* Gives a connection back after use. It is kept for later tac_pool_get()
+ * calls if the server agreed to single-connection mode, closed otherwise.
+ */
+void tac_pool_put(int fd, struct addrinfo *server, char *key) {
+    struct tac_pool_ent *e;
+
+    if (fd < 0)
+        return;
+
+    if (tac_pool_idle <= 0 || server == NULL || !tac_sconn_enabled(fd)
+        || server->ai_addrlen > sizeof(e->addr)) {
+        tac_close(fd);
+        return;
+    }
+
+    e = (struct tac_pool_ent *) xcalloc(1, sizeof(struct tac_pool_ent));
+    bcopy(server->ai_addr, &e->addr, server->ai_addrlen);
+    e->addrlen = server->ai_addrlen;
+    e->key = xstrdup(key != NULL ? key : "");
+    e->fd = fd;
+    e->pid = getpid();
+    e->last_used = _tac_pool_now();
+    e->next = pool;
+    pool = e;
+
+    tac_pool_reap();
+}
+
+/* Returns a pooled connection to server if there is a live one,
+ * a new connection otherwise; see tac_connect_single().
+ */
+int tac_connect_pooled(struct addrinfo *server, char *key) {
+    int fd;
+
+    if (server != NULL && (fd = tac_pool_get(server, key)) >= 0)
+        return fd;
+    return tac_connect_single(server, key);
+}
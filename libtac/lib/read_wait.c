@@ -18,106 +18,117 @@
  * See `CHANGES' file for revision history.
  */
 
-#include <sys/time.h>
 #include <poll.h>
-#include <sys/ioctl.h>
 #include <errno.h>
 
 #include "libtac.h"
 
-/* FIONREAD support for sun */
-#ifdef sun
-#include <sys/filio.h>
-#endif
-
-static int delta_msecs(struct timeval *newer, struct timeval *older) {
-    long deltasecs, deltausecs;
-    struct timeval now;
-
-    if (newer == NULL) {
-        gettimeofday(&now, NULL);
-        newer = &now;
-    }
-
-    deltasecs = newer->tv_sec - older->tv_sec;
-    deltausecs = newer->tv_usec - older->tv_usec;
-    if ( newer->tv_usec < older->tv_usec ) {
-        deltasecs--;
-        deltausecs = (1000000+newer->tv_usec) - older->tv_usec;
-    } else {
-        deltausecs = newer->tv_usec - older->tv_usec;
-    }
-    return (deltasecs*1000)+(deltausecs/1000);
-}
-
-
 /*
- * tac_read_wait
+ * tac_readn
+ *
+ * Reads len bytes from the non blocking fd, waiting for them as long
+ * as it takes.
  *
  * Parms:
- *   fd       - open fd to wait on till data avail, or timeout
- *   timeout  - maximum time to wait in milliseconds
- *   size     - amount of data to wait for
- *           0 : any amount of data
- *          >0 : amount of data to wait for
- *   timeleft - return of time left from timeout
+ *   fd       - open fd to read from
+ *   buf      - where to put the data
+ *   len      - amount of data to read
+ *   timeleft - milliseconds to wait at most, updated with the time
+ *              left; NULL to wait without timeout
  *
  * Returns:
- *    0 - data avail, no timeout
- *   -1 - timeout
- *    n - errno
+ *   len     - success
+ *   < len   - end of file, error or timeout (errno ETIMEDOUT)
  */
 
-int tac_read_wait(int fd, int timeout, int size, int *time_left) {
-    int retval = 0;
-    int remaining;
+int tac_readn(int fd, void *buf, int len, int *timeleft) {
     struct pollfd fds[1];
+    long deadline = 0;
+    int done = 0;
+    int rc, remaining;
 
-    struct timeval start;
-
-    gettimeofday(&start, NULL);
-
-    /* setup for read timeout. 
-    *   will use poll() as it provides greatest compatibility
-    *   vs setsockopt(SO_RCVTIMEO) which isn't supported on Solaris
-    */
-
-    remaining = timeout;  /* in msecs */
+    if (timeleft != NULL)
+        deadline = _tac_now_msecs() + *timeleft;
 
     fds[0].fd = fd;
     fds[0].events = POLLIN;
 
-    while (remaining > 0) {
-        int rc;
-        int avail = 0;
-        rc = poll(fds, 1, remaining);
-        remaining -= delta_msecs(NULL, &start);
-        if ( time_left != NULL ) {
-            *time_left = remaining > 0 ? remaining : 0;
+    while (done < len) {
+        rc = _tac_tls_read(fd, (char *) buf + done, len - done);
+        if (rc > 0) {
+            done += rc;
+            continue;
         }
-
-        /* why did poll return */
-        if (rc == 0) {    /* Receive timeout */
-            retval = -1;
+        if (rc == 0) {
+            errno = 0;      /* end of file */
             break;
         }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            break;
 
-        if (rc > 0) {     /* there is data available */
-            if (size > 0 &&    /* check for enuf available? */
-                ioctl(fd,FIONREAD,(char*)&avail) == 0 && avail < size) {
-                continue;   /* not enuf yet, wait for more */
-            } else {
+        remaining = -1;
+        if (timeleft != NULL) {
+            remaining = deadline - _tac_now_msecs();
+            if (remaining <= 0) {
+                errno = ETIMEDOUT;
                 break;
             }
         }
+        if (poll(fds, 1, remaining) < 0
+            && errno != EINTR)
+            break;
+    }
 
-        if (rc < 0 && errno == EINTR) {   /* interrupt */
+    if (timeleft != NULL) {
+        *timeleft = deadline - _tac_now_msecs();
+        if (*timeleft < 0)
+            *timeleft = 0;
+    }
+    return done;
+}    /* tac_readn */
+
+
+/*
+ * tac_writen
+ *
+ * Writes len bytes to the non blocking fd, waiting at most tac_timeout
+ * seconds, and no longer than the transaction deadline, for the socket
+ * to take all of them.
+ *
+ * Returns:
+ *   len     - success
+ *   < len   - error or timeout (errno ETIMEDOUT)
+ *   -1      - error before anything was written
+ */
+
+int tac_writen(int fd, const void *buf, int len) {
+    struct pollfd fds[1];
+    long deadline = _tac_now_msecs() + _tac_time_left(tac_timeout*1000);
+    int done = 0;
+    int rc, remaining;
+
+    fds[0].fd = fd;
+    fds[0].events = POLLOUT;
+
+    while (done < len) {
+        rc = _tac_tls_write(fd, (const char *) buf + done, len - done);
+        if (rc > 0) {
+            done += rc;
             continue;
         }
+        /* EINPROGRESS: fast open without a cookie, the SYN went out
+         * alone and the handshake has to complete first */
+        if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+            && errno != EINTR && errno != EINPROGRESS)
+            break;
 
-        /* all other conditions is an error */
-        retval = errno;
-        break;
+        remaining = deadline - _tac_now_msecs();
+        if (remaining <= 0) {
+            errno = ETIMEDOUT;
+            break;
+        }
+        if (poll(fds, 1, remaining) < 0 && errno != EINTR)
+            break;
     }
-    return retval;
-}    /* read_wait */
+    return (done == 0 && len > 0) ? -1 : done;
+}    /* tac_writen */
@@ -0,0 +1,164 @@
+/* resolve.c - Cached, parallel server name resolution.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#define _GNU_SOURCE     /* getaddrinfo_a */
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <time.h>
+
+#include "libtac.h"
+#include "xalloc.h"
+
+/* Seconds a resolved server name is used before it is looked up again,
+ * 0 to look it up every time. getaddrinfo() does not tell the TTL of
+ * the records, so it is configured.
+ */
+int tac_dns_ttl = TAC_PLUS_DNS_TTL;
+
+struct tac_dns_ent {
+    char *host;
+    char *port;
+    struct addrinfo *res;
+    time_t expires;
+    int queued;         /* in the batch being resolved */
+};
+
+/* one slot per name ever asked for, there are only a handful */
+static struct tac_dns_ent *dns_cache = NULL;
+static int dns_cache_no = 0;
+
+static time_t _tac_dns_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static struct tac_dns_ent *_tac_dns_find(const char *host, const char *port) {
+    int i;
+
+    for (i = 0; i < dns_cache_no; i++) {
+        if (!strcmp(dns_cache[i].host, host)
+            && !strcmp(dns_cache[i].port, port))
+            return &dns_cache[i];
+    }
+    dns_cache = (struct tac_dns_ent *) xrealloc(dns_cache,
+        (dns_cache_no + 1) * sizeof(struct tac_dns_ent));
+    bzero(&dns_cache[dns_cache_no], sizeof(struct tac_dns_ent));
+    dns_cache[dns_cache_no].host = xstrdup((char *) host);
+    dns_cache[dns_cache_no].port = xstrdup((char *) port);
+    return &dns_cache[dns_cache_no++];
+}
+
+/* Stores a fresh lookup result, or keeps serving the stale one when the
+ * lookup failed; the next call tries again.
+ */
+static void _tac_dns_store(struct tac_dns_ent *e, int rv,
+    struct addrinfo *res, time_t now) {
+
+    if (rv != 0) {
+        TACSYSLOG((LOG_ERR, "%s: cannot resolve %s (getaddrinfo: %s)%s",\
+            __FUNCTION__, e->host, gai_strerror(rv),\
+            e->res != NULL ? ", using previous addresses" : ""))
+        return;
+    }
+    if (e->res != NULL)
+        freeaddrinfo(e->res);
+    e->res = res;
+    e->expires = now + tac_dns_ttl;
+}
+
+/* Looks up n servers given by host and port (NULL for the TACACS+
+ * port). Names resolved less than tac_dns_ttl seconds ago come from
+ * the cache, the others are resolved all at once. res[i] is the
+ * address list of server i, NULL if it cannot be resolved; the lists
+ * belong to the cache and stay valid until the next call.
+ */
+void tac_resolve(char **host, char **port, struct addrinfo **res, int n) {
+    struct tac_dns_ent **ent;
+    struct addrinfo hints;
+    time_t now = _tac_dns_now();
+    char portstr[8];
+    int i, stale = 0;
+
+    snprintf(portstr, sizeof(portstr), "%d", TAC_PLUS_PORT);
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;  /* use IPv4 or IPv6, whichever */
+    hints.ai_socktype = SOCK_STREAM;
+
+    /* the cache may move while it grows, look entries up first */
+    for (i = 0; i < n; i++)
+        _tac_dns_find(host[i], port[i] != NULL ? port[i] : portstr);
+    ent = (struct tac_dns_ent **) xcalloc(n, sizeof(struct tac_dns_ent *));
+    for (i = 0; i < n; i++) {
+        ent[i] = _tac_dns_find(host[i], port[i] != NULL ? port[i] : portstr);
+        if (ent[i]->res == NULL || now >= ent[i]->expires)
+            stale++;
+    }
+
+    if (stale > 0) {
+#ifdef HAVE_GETADDRINFO_A
+        struct gaicb *cb, **list;
+        int j = 0;
+
+        cb = (struct gaicb *) xcalloc(stale, sizeof(struct gaicb));
+        list = (struct gaicb **) xcalloc(stale, sizeof(struct gaicb *));
+        for (i = 0; i < n; i++) {
+            /* the same name given twice is looked up once */
+            if ((ent[i]->res != NULL && now < ent[i]->expires)
+                || ent[i]->queued)
+                continue;
+            ent[i]->queued = 1;
+            cb[j].ar_name = ent[i]->host;
+            cb[j].ar_service = ent[i]->port;
+            cb[j].ar_request = &hints;
+            list[j] = &cb[j];
+            j++;
+        }
+        if (getaddrinfo_a(GAI_WAIT, list, j, NULL) != 0)
+            TACDEBUG((LOG_DEBUG, "%s: some lookups failed", __FUNCTION__))
+        for (i = 0; i < n; i++)
+            ent[i]->queued = 0;
+        for (i = 0; i < j; i++) {
+            _tac_dns_store(_tac_dns_find(cb[i].ar_name, cb[i].ar_service),
+                gai_error(&cb[i]), cb[i].ar_result, now);
+        }
+        free(list);
+        free(cb);
+#else
+        struct addrinfo *r;
+        int rv;
+
+        for (i = 0; i < n; i++) {
+            if (ent[i]->res != NULL && now < ent[i]->expires)
+                continue;
+            r = NULL;
+            rv = getaddrinfo(ent[i]->host, ent[i]->port, &hints, &r);
+            _tac_dns_store(ent[i], rv, r, now);
+        }
+#endif
+    }
+
+    for (i = 0; i < n; i++)
+        res[i] = ent[i]->res;
+    free(ent);
+}    /* tac_resolve */
@@ -0,0 +1,430 @@
+/* sconn.c - TACACS+ single-connection mode, reply decoding and routing.
+ *
+ * Copyright (C) 2010, Pawel Krawczyk <pawel.krawczyk@hush.com> and
+ * Jeroen Nijhof <jeroen@jeroennijhof.nl>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <errno.h>
+#include <poll.h>
+
+#include "libtac.h"
+#include "xalloc.h"
+
+/* When tac_single_connect is set, requests carry the
+ * TAC_PLUS_SINGLE_CONNECT_FLAG until the server has answered the first
+ * one. If the server sets the flag in its first reply the connection
+ * stays open after the session ends and may carry any number of further
+ * sessions, also interleaved: replies are matched against the global
+ * session_id, so a caller running several sessions over one fd sets
+ * session_id to the session it wants to read before calling one of
+ * the tac_*_read functions. Replies for other sessions are kept aside
+ * until they are asked for.
+ */
+int tac_single_connect = 0;
+
+#define TAC_SCONN_REQUESTED 0
+#define TAC_SCONN_ON        1
+#define TAC_SCONN_OFF       2
+
+/* a reply that arrived for another session than the one being read */
+struct tac_pkt {
+    HDR th;
+    u_char *body;
+    struct tac_pkt *next;
+};
+
+struct tac_sconn {
+    int fd;
+    int state;
+    struct tac_pkt *pending;
+    u_char *rx;             /* received, not yet decoded bytes */
+    int rx_off;             /* where they start */
+    int rx_len;             /* how many there are */
+    int rx_size;
+    struct tac_sconn *next;
+};
+
+/* a read takes at least that much when it can */
+#define TAC_RX_CHUNK 4096
+
+static struct tac_sconn *sconn_list = NULL;
+
+static struct tac_sconn *_tac_sconn_find(int fd) {
+    struct tac_sconn *sc;
+
+    for (sc = sconn_list; sc != NULL; sc = sc->next) {
+        if (sc->fd == fd)
+            return sc;
+    }
+    return NULL;
+}
+
+static struct tac_sconn *_tac_sconn_get(int fd) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+
+    if (sc == NULL) {
+        sc = (struct tac_sconn *) xcalloc(1, sizeof(struct tac_sconn));
+        sc->fd = fd;
+        sc->state = tac_single_connect ? TAC_SCONN_REQUESTED : TAC_SCONN_OFF;
+        sc->next = sconn_list;
+        sconn_list = sc;
+    }
+    return sc;
+}
+
+/* Returns the flags to be ORed into the header of a request sent on fd */
+u_char _tac_sconn_flags(int fd) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+
+    if (sc == NULL) {
+        if (!tac_single_connect)
+            return 0;
+        sc = _tac_sconn_get(fd);
+    }
+    return sc->state == TAC_SCONN_OFF ? 0 : TAC_PLUS_SINGLE_CONNECT_FLAG;
+}
+
+/* Returns 1 when the server agreed to single-connection mode on fd,
+ * i.e. the connection may be used again after the current session.
+ */
+int tac_sconn_enabled(int fd) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+
+    return sc != NULL && sc->state == TAC_SCONN_ON;
+}
+
+/* Drops the single-connection state, receive buffer and queued replies
+ * of fd without any I/O on it, so a later fd with the same number
+ * starts clean.
+ */
+void _tac_sconn_drop(int fd) {
+    struct tac_sconn **scp, *sc;
+    struct tac_pkt *p;
+
+    for (scp = &sconn_list; *scp != NULL; scp = &(*scp)->next) {
+        if ((*scp)->fd == fd)
+            break;
+    }
+    if ((sc = *scp) != NULL) {
+        *scp = sc->next;
+        while ((p = sc->pending) != NULL) {
+            sc->pending = p->next;
+            free(p->body);
+            free(p);
+        }
+        free(sc->rx);
+        free(sc);
+    }
+}
+
+/* Closes fd and drops its TLS and single-connection state and replies
+ * still queued for it. Use instead of close() on fds opened by libtac.
+ */
+int tac_close(int fd) {
+    _tac_sconn_drop(fd);
+    _tac_tls_close(fd, 1);
+    return close(fd);
+}
+
+/* Replies are read into a receive buffer per fd, as much as there is
+ * in one go, and cut into packets from there: a packet may arrive in
+ * any number of pieces, and one read may bring several packets, e.g.
+ * the replies of sessions multiplexed over a single-connection fd.
+ */
+
+/* Makes room for the next read on fd: points *p to where the bytes go
+ * and returns how many fit, at least what the packet being received
+ * still lacks. The buffer only grows up to TAC_PLUS_MAX_BODY, a larger
+ * packet is refused by _tac_rx_pkt().
+ */
+int _tac_rx_space(int fd, u_char **p) {
+    struct tac_sconn *sc = _tac_sconn_get(fd);
+    int need = TAC_RX_CHUNK;
+
+    if (sc->rx_len >= TAC_PLUS_HDR_SIZE) {
+        HDR *th = (HDR *) (sc->rx + sc->rx_off);
+        u_int32_t len = ntohl(th->datalength);
+
+        if (len <= TAC_PLUS_MAX_BODY
+            && TAC_PLUS_HDR_SIZE + (int) len > need)
+            need = TAC_PLUS_HDR_SIZE + len;
+    }
+
+    /* move what is left of the last read to the front */
+    if (sc->rx_off > 0) {
+        memmove(sc->rx, sc->rx + sc->rx_off, sc->rx_len);
+        sc->rx_off = 0;
+    }
+    if (sc->rx_size < need) {
+        sc->rx = (u_char *) xrealloc(sc->rx, need);
+        sc->rx_size = need;
+    }
+    *p = sc->rx + sc->rx_len;
+    return sc->rx_size - sc->rx_len;
+}
+
+/* Takes n bytes read into the space given by _tac_rx_space() */
+void _tac_rx_commit(int fd, int n) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+
+    if (sc != NULL && n > 0)
+        sc->rx_len += n;
+}
+
+/* Cuts the next whole packet off the receive buffer of fd and decrypts
+ * its body with the current key. A header announcing a body larger
+ * than TAC_PLUS_MAX_BODY is refused before anything is allocated.
+ *
+ * return value:
+ *      1 : packet in th and *body, which must be freed by caller
+ *      0 : no whole packet received yet
+ *   <  0 : LIBTAC_STATUS_PROTOCOL_ERR, the body is too large
+ */
+int _tac_rx_pkt(int fd, HDR *th, u_char **body) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+    u_int32_t len;
+
+    if (sc == NULL || sc->rx_len < TAC_PLUS_HDR_SIZE)
+        return 0;
+    bcopy(sc->rx + sc->rx_off, th, TAC_PLUS_HDR_SIZE);
+    len = ntohl(th->datalength);
+    if (len > TAC_PLUS_MAX_BODY) {
+        TACSYSLOG((LOG_ERR, "%s: reply body of %u bytes, at most %d"\
+            " allowed", __FUNCTION__, len, TAC_PLUS_MAX_BODY))
+        return LIBTAC_STATUS_PROTOCOL_ERR;
+    }
+    if ((u_int32_t) (sc->rx_len - TAC_PLUS_HDR_SIZE) < len)
+        return 0;
+
+    *body = (u_char *) xcalloc(1, len ? len : 1);
+    bcopy(sc->rx + sc->rx_off + TAC_PLUS_HDR_SIZE, *body, len);
+    sc->rx_off += TAC_PLUS_HDR_SIZE + len;
+    sc->rx_len -= TAC_PLUS_HDR_SIZE + len;
+    if (sc->rx_len == 0)
+        sc->rx_off = 0;
+
+    _tac_crypt(*body, th, len);
+    return 1;
+}
+
+/* Status for a connection that ended, or failed, before the packet
+ * being received on it was complete.
+ */
+int _tac_rx_short(int fd) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+    int got = (sc != NULL) ? sc->rx_len : 0;
+
+    if (got < TAC_PLUS_HDR_SIZE) {
+        TACSYSLOG((LOG_ERR,\
+            "%s: short reply header, read %d of %d: %m", __FUNCTION__,\
+            got, TAC_PLUS_HDR_SIZE))
+        return LIBTAC_STATUS_SHORT_HDR;
+    }
+    TACSYSLOG((LOG_ERR,\
+        "%s: short reply body, read %d of %d: %m", __FUNCTION__,\
+        got - TAC_PLUS_HDR_SIZE,\
+        ntohl(((HDR *) (sc->rx + sc->rx_off))->datalength)))
+    return LIBTAC_STATUS_SHORT_BODY;
+}
+
+/* Reads from fd into its receive buffer without waiting.
+ *
+ * return value:
+ *    > 0 : bytes read
+ *      0 : nothing there yet
+ *   <  0 : end of file or error, status code see _tac_rx_short()
+ */
+int _tac_rx_fill(int fd) {
+    u_char *p;
+    int r, room;
+
+    room = _tac_rx_space(fd, &p);
+    do {
+        r = _tac_tls_read(fd, p, room);
+    } while (r < 0 && errno == EINTR);
+
+    if (r > 0) {
+        _tac_rx_commit(fd, r);
+        return r;
+    }
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (r == 0)
+        errno = 0;      /* end of file */
+    return _tac_rx_short(fd);
+}
+
+/* Gets the next packet from fd, reading as needed. The whole packet
+ * has to arrive within *timeleft milliseconds; no limit if timeleft
+ * is NULL.
+ *
+ * return value:
+ *      0 : success, *body (decrypted) must be freed by caller
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+static int _tac_read_pkt(int fd, HDR *th, u_char **body, int *timeleft) {
+    struct pollfd pfd;
+    long deadline = 0;
+    int r, remaining = -1;
+
+    if (timeleft != NULL)
+        deadline = _tac_now_msecs() + *timeleft;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while ((r = _tac_rx_pkt(fd, th, body)) <= 0) {
+        if (r < 0)
+            return r;
+        if ((r = _tac_rx_fill(fd)) < 0)
+            return r;
+        if (r > 0)
+            continue;
+
+        if (timeleft != NULL) {
+            remaining = deadline - _tac_now_msecs();
+            if (remaining <= 0) {
+                *timeleft = 0;
+                TACSYSLOG((LOG_ERR,\
+                    "%s: reply timeout after %d secs", __FUNCTION__,\
+                    tac_timeout))
+                return LIBTAC_STATUS_READ_TIMEOUT;
+            }
+        }
+        if (poll(&pfd, 1, remaining) < 0 && errno != EINTR) {
+            TACSYSLOG((LOG_ERR, "%s: poll failed: %m", __FUNCTION__))
+            return _tac_rx_short(fd);
+        }
+    }
+
+    if (timeleft != NULL) {
+        *timeleft = deadline - _tac_now_msecs();
+        if (*timeleft < 0)
+            *timeleft = 0;
+    }
+    return 0;
+}
+
+/* Takes a reply for the current session_id that was queued while
+ * reading another session on fd.
+ *
+ * return value:
+ *      1 : reply taken, *body must be freed by caller
+ *      0 : nothing queued for this session
+ */
+int _tac_sconn_take(int fd, HDR *th, u_char **body) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+    struct tac_pkt **pp, *p;
+
+    if (sc == NULL)
+        return 0;
+    for (pp = &sc->pending; *pp != NULL; pp = &(*pp)->next) {
+        if (ntohl((*pp)->th.session_id) == (u_int32_t) session_id) {
+            p = *pp;
+            *pp = p->next;
+            bcopy(&p->th, th, TAC_PLUS_HDR_SIZE);
+            *body = p->body;
+            free(p);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Looks at a reply just read from fd: the first one settles
+ * single-connection mode, and on a single-connection fd a reply for
+ * another session than session_id is queued for later.
+ *
+ * return value:
+ *      1 : reply queued, body now belongs to the queue
+ *      0 : reply is for the current session
+ */
+int _tac_sconn_route(int fd, HDR *th, u_char *body) {
+    struct tac_sconn *sc = _tac_sconn_find(fd);
+    struct tac_pkt **pp, *p;
+
+    if (sc == NULL)
+        return 0;
+
+    /* the first reply settles single-connection mode */
+    if (sc->state == TAC_SCONN_REQUESTED) {
+        sc->state = (th->encryption & TAC_PLUS_SINGLE_CONNECT_FLAG) ?
+            TAC_SCONN_ON : TAC_SCONN_OFF;
+        TACDEBUG((LOG_DEBUG, "%s: single-connection mode %s by server",\
+            __FUNCTION__, sc->state == TAC_SCONN_ON ? "accepted" : "refused"))
+    }
+
+    if (ntohl(th->session_id) == (u_int32_t) session_id
+        || sc->state != TAC_SCONN_ON)
+        return 0;
+
+    /* reply for another session multiplexed over this fd */
+    p = (struct tac_pkt *) xcalloc(1, sizeof(struct tac_pkt));
+    bcopy(th, &p->th, TAC_PLUS_HDR_SIZE);
+    p->body = body;
+    for (pp = &sc->pending; *pp != NULL; pp = &(*pp)->next)
+        ;
+    *pp = p;
+    return 1;
+}
+
+/* Reads the reply of given type for the current session_id from fd.
+ * On a single-connection fd replies for other sessions are queued
+ * and a previously queued reply is returned without reading.
+ *
+ * return value:
+ *      0 : success, *body (decrypted) must be freed by caller
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *         LIBTAC_STATUS_READ_TIMEOUT
+ *         LIBTAC_STATUS_SHORT_HDR
+ *         LIBTAC_STATUS_SHORT_BODY
+ *         LIBTAC_STATUS_PROTOCOL_ERR
+ */
+int _tac_read_reply(int fd, int type, HDR *th, u_char **body) {
+    int timeleft;
+    long start = _tac_now_msecs();
+    int ret = 0;
+
+    /* with tac_readtimeout_enable the reply has tac_timeout seconds,
+       and never more than is left of the transaction deadline */
+    timeleft = _tac_time_left(tac_readtimeout_enable ? tac_timeout*1000 : -1);
+    *body = NULL;
+
+    /* already received while reading another session? */
+    if (!_tac_sconn_take(fd, th, body)) {
+        for (;;) {
+            if ((ret = _tac_read_pkt(fd, th, body,
+                timeleft >= 0 ? &timeleft : NULL)) < 0) {
+                tac_health_reply(fd, -1);
+                break;
+            }
+            tac_health_reply(fd, _tac_now_msecs() - start);
+            if (!_tac_sconn_route(fd, th, *body))
+                break;
+            *body = NULL;
+        }
+    }
+
+    if (ret == 0 && _tac_check_header(th, type) != NULL)
+        ret = LIBTAC_STATUS_PROTOCOL_ERR;
+    if (ret < 0) {
+        free(*body);
+        *body = NULL;
+    }
+    return ret;
+}
@@ -0,0 +1,844 @@
+/* session.c - Non-blocking TACACS+ sessions for event loops.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "libtac.h"
+#include "xalloc.h"
+#include "messages.h"
+
+/* A session sends one request on a connected fd and reads the reply
+ * without ever blocking. The caller creates it with one of the
+ * tac_session_authen(), tac_session_author() or tac_session_acct()
+ * functions, waits until tac_session_fd() is ready for what
+ * tac_session_events() asks for (TAC_SESSION_READ, TAC_SESSION_WRITE)
+ * or until tac_session_timeout() milliseconds have passed, and then
+ * calls tac_session_step(). When that returns 0 the session is done
+ * and tac_session_result() gives the same status the blocking
+ * tac_*_read functions would have returned.
+ *
+ * Any number of sessions may share a single-connection fd. Received
+ * bytes are kept in the receive buffer of the fd (see sconn.c), so
+ * whichever session steps next goes on reading, and a reply for
+ * another session is queued for it the way _tac_read_reply() does.
+ * Such a session completes the next time it is stepped, so when an fd
+ * shared by several sessions becomes readable, all of them should be
+ * stepped.
+ */
+
+#define TAC_SESSION_SEND 1
+#define TAC_SESSION_RECV 2
+#define TAC_SESSION_DONE 3
+
+/* per fd state shared by the sessions using it */
+struct tac_io {
+    int fd;
+    int refs;
+    struct tac_session *writer;     /* has written part of its packet */
+    int posted;                     /* a read is queued in the ring */
+    int ready;                      /* fd had an event, step all users */
+    struct tac_io *next;
+};
+
+struct tac_session {
+    struct tac_io *io;
+    int type;               /* TAC_PLUS_AUTHEN, _AUTHOR or _ACCT */
+    int state;
+    int session_id;
+    char *key;
+    int ctrl;
+    u_char *pkt;            /* request, header and encrypted body */
+    int pkt_len;
+    int sent;
+    long start;             /* when the current phase began */
+    long deadline;          /* 0 for none */
+    int seq;                /* seq_no of the last authen reply */
+    int status;
+    char *msg;
+    struct tac_attrib *attr;
+    int posted;             /* SEND or RECV queued in the ring, or 0 */
+};
+
+static struct tac_io *io_list = NULL;
+
+static struct tac_io *_tac_io_get(int fd) {
+    struct tac_io *io;
+
+    for (io = io_list; io != NULL; io = io->next) {
+        if (io->fd == fd) {
+            io->refs++;
+            return io;
+        }
+    }
+    io = (struct tac_io *) xcalloc(1, sizeof(struct tac_io));
+    io->fd = fd;
+    io->refs = 1;
+    io->next = io_list;
+    io_list = io;
+    return io;
+}
+
+static void _tac_io_put(struct tac_io *io) {
+    struct tac_io **iop;
+
+    if (--io->refs > 0)
+        return;
+    for (iop = &io_list; *iop != NULL; iop = &(*iop)->next) {
+        if (*iop == io) {
+            *iop = io->next;
+            break;
+        }
+    }
+    free(io);
+}
+
+/* The packet code works on the global session_id and key; make them
+ * the session's for a while and give back the caller's ones.
+ */
+struct tac_globals {
+    int session_id;
+    int encryption;
+    char *secret;
+};
+
+static void _tac_session_enter(struct tac_session *s, struct tac_globals *g) {
+    g->session_id = session_id;
+    g->encryption = tac_encryption;
+    g->secret = tac_secret;
+    session_id = s->session_id;
+    tac_set_key(s->key);
+}
+
+static void _tac_session_leave(struct tac_globals *g) {
+    session_id = g->session_id;
+    tac_encryption = g->encryption;
+    tac_secret = g->secret;
+}
+
+static struct tac_session *_tac_session_new(int fd, int type, int ctrl) {
+    struct tac_session *s;
+
+    s = (struct tac_session *) xcalloc(1, sizeof(struct tac_session));
+    s->io = _tac_io_get(fd);
+    s->type = type;
+    s->ctrl = ctrl;
+    s->session_id = session_id;
+    s->key = tac_encryption ? tac_secret : NULL;
+    return s;
+}
+
+static void _tac_session_done(struct tac_session *s, int status) {
+    s->state = TAC_SESSION_DONE;
+    s->status = status;
+    if (status < 0 && s->type != TAC_PLUS_AUTHEN && s->msg == NULL) {
+        if (status == LIBTAC_STATUS_PROTOCOL_ERR)
+            s->msg = xstrdup(protocol_err_msg);
+        else
+            s->msg = xstrdup(s->type == TAC_PLUS_AUTHOR ?
+                author_syserr_msg : acct_syserr_msg);
+    }
+    if (s->io->writer == s)
+        s->io->writer = NULL;
+}
+
+/* Takes a packet built by one of the _tac_*_pkt functions, len being
+ * its length or a negative status if building failed.
+ */
+static void _tac_session_send(struct tac_session *s, u_char *pkt, int len) {
+    free(s->pkt);
+    s->pkt = pkt;
+    s->pkt_len = len;
+    s->sent = 0;
+    s->start = _tac_now_msecs();
+    s->deadline = s->start + _tac_time_left(tac_timeout*1000);
+    s->state = TAC_SESSION_SEND;
+    if (len < 0)
+        _tac_session_done(s, len);
+}
+
+struct tac_session *tac_session_authen(int fd, const char *user, char *pass,
+    char *tty, char *r_addr, int action, int ctrl) {
+
+    struct tac_session *s;
+    struct tac_globals g;
+    u_char *pkt = NULL;
+    int len;
+
+    /* a new session_id is made by the packet code */
+    s = _tac_session_new(fd, TAC_PLUS_AUTHEN, ctrl);
+    _tac_session_enter(s, &g);
+    len = _tac_authen_pkt(fd, user, pass, tty, r_addr, action, ctrl, &pkt);
+    s->session_id = session_id;
+    _tac_session_leave(&g);
+
+    _tac_session_send(s, pkt, len);
+    return s;
+}
+
+struct tac_session *tac_session_author(int fd, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr) {
+
+    struct tac_session *s;
+    struct tac_globals g;
+    u_char *pkt = NULL;
+    int len;
+
+    s = _tac_session_new(fd, TAC_PLUS_AUTHOR, 0);
+    _tac_session_enter(s, &g);
+    len = _tac_author_pkt(fd, user, tty, r_addr, attr, &pkt);
+    s->session_id = session_id;
+    _tac_session_leave(&g);
+
+    _tac_session_send(s, pkt, len);
+    return s;
+}
+
+struct tac_session *tac_session_acct(int fd, int type, const char *user,
+    char *tty, char *r_addr, struct tac_attrib *attr) {
+
+    struct tac_session *s;
+    struct tac_globals g;
+    u_char *pkt = NULL;
+    int len;
+
+    s = _tac_session_new(fd, TAC_PLUS_ACCT, 0);
+    _tac_session_enter(s, &g);
+    len = _tac_acct_pkt(fd, type, user, tty, r_addr, attr, &pkt);
+    s->session_id = session_id;
+    _tac_session_leave(&g);
+
+    _tac_session_send(s, pkt, len);
+    return s;
+}
+
+/* Answers an authentication reply asking for more data (GETPASS,
+ * GETDATA, GETUSER) with a CONTINUE packet carrying data. The
+ * session then goes on as a new one would, starting with a step.
+ *
+ * return value:
+ *      0 : success
+ *   <  0 : session is not waiting for data
+ */
+int tac_session_cont(struct tac_session *s, char *data) {
+    struct tac_globals g;
+    u_char *pkt = NULL;
+    int len;
+
+    if (s->type != TAC_PLUS_AUTHEN || s->state != TAC_SESSION_DONE
+        || s->status < 0)
+        return LIBTAC_STATUS_ASSEMBLY_ERR;
+
+    free(s->msg);
+    s->msg = NULL;
+
+    _tac_session_enter(s, &g);
+    len = _tac_cont_pkt(s->io->fd, data, s->ctrl, s->seq+1, &pkt);
+    _tac_session_leave(&g);
+
+    _tac_session_send(s, pkt, len);
+    return 0;
+}
+
+int tac_session_fd(struct tac_session *s) {
+    return s->io->fd;
+}
+
+/* Returns what the session waits for on its fd: TAC_SESSION_READ,
+ * TAC_SESSION_WRITE, or 0 when it is done.
+ */
+int tac_session_events(struct tac_session *s) {
+    switch (s->state) {
+        case TAC_SESSION_SEND:
+            return TAC_SESSION_WRITE;
+        case TAC_SESSION_RECV:
+            return TAC_SESSION_READ;
+        default:
+            return 0;
+    }
+}
+
+/* Returns the milliseconds after which the session should be stepped
+ * even if its fd did not become ready, -1 for no limit.
+ */
+int tac_session_timeout(struct tac_session *s) {
+    long left;
+
+    if (s->state == TAC_SESSION_DONE || s->deadline == 0)
+        return -1;
+    left = s->deadline - _tac_now_msecs();
+    return left > 0 ? left : 0;
+}
+
+/* Writes as much of the request as the fd takes.
+ *
+ * return value:
+ *      1 : all written
+ *      0 : fd is full, wait for it
+ *   <  0 : error status code
+ */
+static int _tac_session_write(struct tac_session *s) {
+    struct tac_io *io = s->io;
+    int w;
+
+    /* another session is halfway through its packet */
+    if (io->writer != NULL && io->writer != s)
+        return 0;
+
+    while (s->sent < s->pkt_len) {
+        w = _tac_tls_write(io->fd, s->pkt + s->sent, s->pkt_len - s->sent);
+        if (w > 0) {
+            s->sent += w;
+            io->writer = s;
+            continue;
+        }
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+            || errno == EINPROGRESS))    /* fast open handshake */
+            return 0;
+        TACSYSLOG((LOG_ERR,\
+            "%s: short write on packet, wrote %d of %d: %m",\
+            __FUNCTION__, s->sent, s->pkt_len))
+        return LIBTAC_STATUS_WRITE_ERR;
+    }
+    io->writer = NULL;
+    return 1;
+}
+
+/* Decodes the reply for this session and completes it */
+static void _tac_session_reply(struct tac_session *s, HDR *th, u_char *body) {
+    struct areply re;
+    msg_status ms;
+
+    if (_tac_check_header(th, s->type) != NULL) {
+        free(body);
+        _tac_session_done(s, LIBTAC_STATUS_PROTOCOL_ERR);
+        return;
+    }
+
+    switch (s->type) {
+        case TAC_PLUS_AUTHEN:
+            bzero(&ms, sizeof(ms));
+            _tac_authen_reply(&ms, th, body, s->ctrl, &s->seq);
+            s->msg = ms.server_msg;
+            _tac_session_done(s, (signed char) ms.status);
+            break;
+        case TAC_PLUS_AUTHOR:
+            bzero(&re, sizeof(re));
+            _tac_author_reply(th, body, &re);
+            s->msg = re.msg;
+            s->attr = re.attr;
+            _tac_session_done(s, re.status);
+            break;
+        default:
+            bzero(&re, sizeof(re));
+            _tac_acct_reply(th, body, &re);
+            s->msg = re.msg;
+            _tac_session_done(s, re.status);
+            break;
+    }
+}
+
+/* Completes a session that ran out of time */
+static void _tac_session_expire(struct tac_session *s) {
+    if (s->state == TAC_SESSION_SEND) {
+        TACSYSLOG((LOG_ERR,\
+            "%s: write timeout after %d secs", __FUNCTION__, tac_timeout))
+        _tac_session_done(s, LIBTAC_STATUS_WRITE_TIMEOUT);
+    } else {
+        TACSYSLOG((LOG_ERR,\
+            "%s: reply timeout after %d secs", __FUNCTION__, tac_timeout))
+        tac_health_reply(s->io->fd, -1);
+        _tac_session_done(s, LIBTAC_STATUS_READ_TIMEOUT);
+    }
+}
+
+/* The whole request is out, wait for the reply */
+static void _tac_session_sent(struct tac_session *s) {
+    int left;
+
+    left = _tac_time_left(tac_readtimeout_enable ? tac_timeout*1000 : -1);
+    s->io->writer = NULL;
+    s->state = TAC_SESSION_RECV;
+    s->start = _tac_now_msecs();
+    s->deadline = left >= 0 ? s->start + left : 0;
+}
+
+/* Completes the session with a reply queued for it by another one.
+ *
+ * return value:
+ *      1 : there was one
+ *      0 : nothing queued
+ */
+static int _tac_session_queued(struct tac_session *s) {
+    HDR th;
+    u_char *body = NULL;
+
+    if (!_tac_sconn_take(s->io->fd, &th, &body))
+        return 0;
+    _tac_session_reply(s, &th, body);
+    return 1;
+}
+
+/* Takes a whole packet received on the session's fd: completes the
+ * session with it, or queues it for the session it belongs to.
+ */
+static void _tac_session_packet(struct tac_session *s, HDR *th,
+    u_char *body) {
+
+    tac_health_reply(s->io->fd, _tac_now_msecs() - s->start);
+    if (!_tac_sconn_route(s->io->fd, th, body))
+        _tac_session_reply(s, th, body);
+}
+
+/* Ends a waiting session after reading its fd failed, r being the
+ * status code.
+ */
+static void _tac_session_failed(struct tac_session *s, int r) {
+    tac_health_reply(s->io->fd, -1);
+    _tac_session_done(s, r);
+}
+
+/* Goes on with a waiting session using what has been received on its
+ * fd so far, without reading.
+ *
+ * return value:
+ *      1 : still waiting for its reply
+ *      0 : done
+ */
+static int _tac_session_drain(struct tac_session *s) {
+    HDR th;
+    u_char *body;
+    int r;
+
+    while (s->state == TAC_SESSION_RECV) {
+        /* already received while reading another session? */
+        if (_tac_session_queued(s))
+            break;
+        if ((r = _tac_rx_pkt(s->io->fd, &th, &body)) == 0)
+            return 1;
+        if (r < 0) {
+            _tac_session_failed(s, r);
+            break;
+        }
+        _tac_session_packet(s, &th, body);
+    }
+    return 0;
+}
+
+/* Does whatever the session can do without blocking, to be called
+ * when its fd is ready or its timeout has passed.
+ *
+ * return value:
+ *   TAC_SESSION_READ, TAC_SESSION_WRITE : not done yet, wait for that
+ *      0 : done, see tac_session_result()
+ */
+int tac_session_step(struct tac_session *s) {
+    struct tac_globals g;
+    int r;
+
+    if (s->state == TAC_SESSION_DONE)
+        return 0;
+
+    _tac_session_enter(s, &g);
+
+    if (s->state == TAC_SESSION_SEND) {
+        r = _tac_session_write(s);
+        if (r < 0) {
+            _tac_session_done(s, r);
+        } else if (r > 0) {
+            _tac_session_sent(s);
+        } else if (_tac_now_msecs() >= s->deadline) {
+            _tac_session_expire(s);
+        }
+    }
+
+    while (_tac_session_drain(s)) {
+        r = _tac_rx_fill(s->io->fd);
+        if (r < 0) {
+            _tac_session_failed(s, r);
+        } else if (r == 0) {
+            if (s->deadline != 0 && _tac_now_msecs() >= s->deadline)
+                _tac_session_expire(s);
+            break;
+        }
+    }
+
+    _tac_session_leave(&g);
+    return tac_session_events(s);
+}
+
+/* Returns the outcome of a finished session, as tac_authen_read(),
+ * tac_author_read() and tac_acct_read() do, moving the server message
+ * and, for authorization, the attributes into re (freed by caller).
+ * re may be NULL if only the status is wanted.
+ *
+ * return value:
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ *   >= 0 : server response, see TAC_PLUS_..._STATUS_...
+ */
+int tac_session_result(struct tac_session *s, struct areply *re) {
+    if (re != NULL) {
+        re->msg = s->msg;
+        re->attr = s->attr;
+        re->status = s->status;
+        s->msg = NULL;
+        s->attr = NULL;
+    }
+    return s->status;
+}
+
+/* Frees the session; its fd is left open. A request still in progress
+ * is abandoned, so a single-connection fd should then be closed.
+ */
+void tac_session_free(struct tac_session *s) {
+    if (s->io->writer == s)
+        s->io->writer = NULL;
+    _tac_io_put(s->io);
+    free(s->pkt);
+    free(s->msg);
+    tac_free_attrib(&s->attr);
+    free(s);
+}
+
+/* Waits for the sessions with poll() and steps them until all of
+ * them are done.
+ */
+static void _tac_session_run_poll(struct tac_session **s, int n) {
+    struct pollfd *fds;
+    int i, ev, left, timeout, t;
+
+    fds = (struct pollfd *) xcalloc(n, sizeof(struct pollfd));
+    for (;;) {
+        left = 0;
+        timeout = -1;
+        for (i = 0; i < n; i++) {
+            ev = tac_session_events(s[i]);
+            fds[i].fd = ev ? tac_session_fd(s[i]) : -1;
+            fds[i].events = ((ev & TAC_SESSION_READ) ? POLLIN : 0)
+                | ((ev & TAC_SESSION_WRITE) ? POLLOUT : 0);
+            fds[i].revents = 0;
+            if (ev == 0)
+                continue;
+            left++;
+            t = tac_session_timeout(s[i]);
+            if (t >= 0 && (timeout < 0 || t < timeout))
+                timeout = t;
+        }
+        if (left == 0)
+            break;
+
+        if (poll(fds, n, timeout) < 0 && errno != EINTR) {
+            TACSYSLOG((LOG_ERR, "%s: poll failed: %m", __FUNCTION__))
+            break;
+        }
+
+        /* a packet read for one session may complete another on the
+         * same fd, so every session on a ready fd is stepped */
+        for (i = 0; i < n; i++) {
+            if (fds[i].revents)
+                s[i]->io->ready = 1;
+        }
+        for (i = 0; i < n; i++) {
+            if (s[i]->io->ready || tac_session_timeout(s[i]) == 0)
+                tac_session_step(s[i]);
+        }
+        for (i = 0; i < n; i++)
+            s[i]->io->ready = 0;
+    }
+    free(fds);
+}
+
+#ifdef HAVE_LIBURING
+/* Queues the next operation the session needs in the ring: a send of
+ * the rest of its request or a recv of the rest of the packet on its
+ * fd, which only one session at a time may have queued.
+ */
+static void _tac_session_post(struct io_uring *ring, struct tac_session *s) {
+    struct tac_io *io = s->io;
+    struct io_uring_sqe *sqe;
+    struct tac_globals g;
+    u_char *p;
+    int room;
+
+    if (s->posted || s->state == TAC_SESSION_DONE)
+        return;
+
+    if (s->state == TAC_SESSION_RECV) {
+        _tac_session_enter(s, &g);
+        _tac_session_drain(s);
+        _tac_session_leave(&g);
+        if (s->state == TAC_SESSION_DONE || io->posted)
+            return;
+    }
+    if (s->state == TAC_SESSION_SEND && io->writer != NULL && io->writer != s)
+        return;
+
+    if ((sqe = io_uring_get_sqe(ring)) == NULL) {
+        io_uring_submit(ring);
+        if ((sqe = io_uring_get_sqe(ring)) == NULL)
+            return;
+    }
+
+    if (s->state == TAC_SESSION_SEND) {
+        io_uring_prep_send(sqe, io->fd, s->pkt + s->sent,
+            s->pkt_len - s->sent, MSG_NOSIGNAL);
+        io->writer = s;
+    } else {
+        room = _tac_rx_space(io->fd, &p);
+        io_uring_prep_recv(sqe, io->fd, p, room, 0);
+        io->posted = 1;
+    }
+    io_uring_sqe_set_data(sqe, s);
+    s->posted = s->state;
+}
+
+/* Takes the result of an operation queued for the session */
+static void _tac_session_complete(struct tac_session *s, int res) {
+    struct tac_io *io = s->io;
+    struct tac_globals g;
+    int posted = s->posted;
+
+    s->posted = 0;
+    if (posted == TAC_SESSION_RECV)
+        io->posted = 0;
+    if (s->state == TAC_SESSION_DONE)
+        return;
+
+    _tac_session_enter(s, &g);
+    if (posted == TAC_SESSION_SEND) {
+        if (res > 0)
+            s->sent += res;
+        if (s->sent == s->pkt_len) {
+            _tac_session_sent(s);
+        } else if (res < 0 && res != -EAGAIN && res != -EINTR
+            && res != -EINPROGRESS) {
+            errno = -res;
+            TACSYSLOG((LOG_ERR,\
+                "%s: short write on packet, wrote %d of %d: %m",\
+                __FUNCTION__, s->sent, s->pkt_len))
+            _tac_session_done(s, LIBTAC_STATUS_WRITE_ERR);
+        }
+    } else {
+        if (res > 0) {
+            _tac_rx_commit(io->fd, res);
+            _tac_session_drain(s);
+        } else if (res != -EAGAIN && res != -EINTR) {
+            errno = res < 0 ? -res : 0;
+            _tac_session_failed(s, _tac_rx_short(io->fd));
+        }
+    }
+    _tac_session_leave(&g);
+}
+
+/* Drives the sessions with io_uring: every round queues the sends
+ * and recvs all sessions need and submits them with one system call,
+ * which also waits for the first completion.
+ *
+ * return value:
+ *      0 : all sessions done
+ *     -1 : no io_uring here, nothing was done
+ */
+static int _tac_session_run_uring(struct tac_session **s, int n) {
+    struct io_uring ring;
+    struct io_uring_cqe *cqe;
+    struct io_uring_sqe *sqe;
+    struct __kernel_timespec ts;
+    unsigned head, seen;
+    int i, left, posted, timeout, t;
+
+    if (io_uring_queue_init(n < 4096 ? n : 4096, &ring, 0) < 0)
+        return -1;
+
+    for (;;) {
+        left = posted = 0;
+        timeout = -1;
+        for (i = 0; i < n; i++) {
+            t = tac_session_timeout(s[i]);
+            if (t == 0) {
+                /* the queued operation is cancelled before the
+                 * caller may free its buffers */
+                if (s[i]->posted
+                    && (sqe = io_uring_get_sqe(&ring)) != NULL) {
+                    io_uring_prep_cancel(sqe, s[i], 0);
+                    io_uring_sqe_set_data(sqe, NULL);
+                }
+                _tac_session_expire(s[i]);
+            }
+            _tac_session_post(&ring, s[i]);
+            if (s[i]->state != TAC_SESSION_DONE)
+                left++;
+            if (s[i]->posted)
+                posted++;
+            t = tac_session_timeout(s[i]);
+            if (t >= 0 && (timeout < 0 || t < timeout))
+                timeout = t;
+        }
+        if (left == 0 && posted == 0)
+            break;
+
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000L;
+        }
+        io_uring_submit_and_wait_timeout(&ring, &cqe, 1,
+            timeout >= 0 ? &ts : NULL, NULL);
+
+        seen = 0;
+        io_uring_for_each_cqe(&ring, head, cqe) {
+            if (io_uring_cqe_get_data(cqe) != NULL)
+                _tac_session_complete(
+                    (struct tac_session *) io_uring_cqe_get_data(cqe),
+                    cqe->res);
+            seen++;
+        }
+        io_uring_cq_advance(&ring, seen);
+    }
+
+    io_uring_queue_exit(&ring);
+    return 0;
+}
+#endif
+
+/* Runs the sessions until all of them are done, for callers that have
+ * a batch of requests and no event loop of their own. With io_uring
+ * the sends and recvs of all sessions go to the kernel in one system
+ * call per round, otherwise they wait together in poll().
+ */
+void tac_session_run(struct tac_session **s, int n) {
+#ifdef HAVE_LIBURING
+    int i;
+#endif
+
+    if (n <= 0)
+        return;
+#ifdef HAVE_LIBURING
+    /* the ring would go around TLS (see tls.c), such fds use poll */
+    for (i = 0; i < n && !tac_tls_active(s[i]->io->fd); i++)
+        ;
+    if (i == n && _tac_session_run_uring(s, n) == 0)
+        return;
+    TACDEBUG((LOG_DEBUG, "%s: no io_uring, using poll", __FUNCTION__))
+#endif
+    _tac_session_run_poll(s, n);
+}
+
+/* Sends an accounting record to all servers at once: connects to all of
+ * them together (see tac_connect_all()), builds the record once and
+ * gives each server a copy with its own session_id, encrypting all the
+ * copies in one _tac_crypt_batch(), and waits for all replies in one
+ * tac_session_run(), so the slowest server and not the sum of them
+ * sets the pace. Connections that got a reply go back to the pool.
+ * status[i] gets the outcome for server[i], the status of its reply or
+ * a LIBTAC_STATUS_ code.
+ *
+ * return value:
+ *   number of servers that took the record
+ */
+int tac_acct_all(int type, const char *user, char *tty, char *r_addr,
+    struct tac_attrib *attr, struct addrinfo **server, char **key,
+    int servers, int *status) {
+
+    struct tac_session **s, **run;
+    struct tac_crypt_job *job;
+    char *secret = tac_secret;
+    int encryption = tac_encryption;
+    int sid = session_id;
+    u_char *body, *pkt;
+    int *fd, i, n = 0, ok = 0, body_len;
+
+    if (servers <= 0)
+        return 0;
+
+    fd = (int *) xcalloc(servers, sizeof(int));
+    s = (struct tac_session **) xcalloc(servers, sizeof(struct tac_session *));
+    run = (struct tac_session **) xcalloc(servers,
+        sizeof(struct tac_session *));
+    job = (struct tac_crypt_job *) xcalloc(servers,
+        sizeof(struct tac_crypt_job));
+
+    for (i = 0; i < servers; i++)
+        fd[i] = tac_pool_get(server[i], key[i]);
+    tac_connect_all(server, servers, fd);
+
+    body_len = _tac_acct_body(type, user, tty, r_addr, attr, &body);
+    TACDEBUG((LOG_DEBUG, "%s: user '%s', tty '%s', rem_addr '%s', type: %s",\
+        __FUNCTION__, user, tty, r_addr, tac_acct_flag2str(type)))
+    for (i = 0; i < servers; i++) {
+        HDR *th;
+
+        if (fd[i] < 0) {
+            status[i] = fd[i];
+            continue;
+        }
+        tac_set_key(key[i]);
+        s[i] = run[n] = _tac_session_new(fd[i], TAC_PLUS_ACCT, 0);
+
+        th = _tac_req_header(TAC_PLUS_ACCT, 0);
+        th->version = TAC_PLUS_VER_0;
+        th->encryption = tac_encryption ? TAC_PLUS_ENCRYPTED_FLAG
+            : TAC_PLUS_UNENCRYPTED_FLAG;
+        th->encryption |= _tac_sconn_flags(fd[i]);
+        th->datalength = htonl(body_len);
+        s[i]->session_id = session_id;
+
+        pkt = _tac_pkt_join(th, body, body_len);
+        job[n].buf = pkt + TAC_PLUS_HDR_SIZE;
+        job[n].len = body_len;
+        job[n].th = (HDR *) pkt;
+        job[n].key = s[i]->key;
+        _tac_session_send(s[i], pkt, TAC_PLUS_HDR_SIZE + body_len);
+        free(th);
+        n++;
+    }
+    _tac_crypt_batch(job, n);
+    free(body);
+    session_id = sid;
+    tac_secret = secret;
+    tac_encryption = encryption;
+
+    tac_session_run(run, n);
+
+    for (i = 0; i < servers; i++) {
+        if (s[i] == NULL)
+            continue;
+        status[i] = tac_session_result(s[i], NULL);
+        tac_session_free(s[i]);
+        if (status[i] < 0) {
+            tac_close(fd[i]);
+            continue;
+        }
+        tac_pool_put(fd[i], server[i], key[i]);
+        if (status[i] == TAC_PLUS_ACCT_STATUS_SUCCESS)
+            ok++;
+    }
+
+    free(job);
+    free(run);
+    free(s);
+    free(fd);
+    return ok;
+}    /* tac_acct_all */
@@ -0,0 +1,363 @@
+/* srvtab.c - Table of TACACS+ servers and server groups.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include "libtac.h"
+#include "xalloc.h"
+
+/* A server= option, kept until the table is built */
+struct tac_srv_spec {
+    char *host;
+    char *port;         /* NULL for the TACACS+ port */
+    char *key;          /* NULL for the matching secret= option */
+    char *group;
+    int timeout;
+    int weight;
+    int keepalive;
+    int user_timeout;
+};
+
+static struct tac_srv_spec *spec = NULL;
+static int spec_no = 0;
+static char **spec_key = NULL;
+static int spec_key_no = 0;
+
+/* One entry per address, the servers of a group next to each other */
+struct tac_server *tac_server = NULL;
+int tac_server_no = 0;
+struct tac_group *tac_group = NULL;
+int tac_group_no = 0;
+
+/* handed out by tac_srvtab_group() */
+static struct addrinfo **sel_srv = NULL;
+static char **sel_key = NULL;
+
+/* Forgets the server= and secret= options given so far; the table
+ * built from them stays in use until the next tac_srvtab_build().
+ */
+void tac_srvtab_reset(void) {
+    int i;
+
+    for (i = 0; i < spec_no; i++) {
+        free(spec[i].host);
+        free(spec[i].port);
+        free(spec[i].key);
+        free(spec[i].group);
+    }
+    free(spec);
+    spec = NULL;
+    spec_no = 0;
+
+    for (i = 0; i < spec_key_no; i++)
+        free(spec_key[i]);
+    free(spec_key);
+    spec_key = NULL;
+    spec_key_no = 0;
+}
+
+/* Adds a server given as HOST[:PORT][,secret=KEY][,timeout=SEC]
+ * [,weight=N][,keepalive=SEC][,user_timeout=MSEC][,group=NAME]; an
+ * IPv6 address with a port is written as [ADDR]:PORT.
+ *
+ * return value:
+ *      0 : server added
+ *     -1 : malformed server
+ */
+int tac_srvtab_add(const char *arg) {
+    struct tac_srv_spec s;
+    char *buf, *host, *opt, *next, *port = NULL;
+
+    bzero(&s, sizeof(s));
+    s.weight = 1;
+    host = buf = xstrdup((char *) arg);
+
+    if ((opt = strchr(host, ',')) != NULL)
+        *opt++ = '\0';
+
+    if (*host == '[') {
+        if ((port = strchr(++host, ']')) == NULL) {
+            TACSYSLOG((LOG_ERR, "%s: unterminated address in %s",\
+                __FUNCTION__, arg))
+            free(buf);
+            return -1;
+        }
+        *port++ = '\0';
+        port = (*port == ':') ? port + 1 : NULL;
+    } else if ((port = strchr(host, ':')) != NULL) {
+        *port++ = '\0';
+    }
+    if (*host == '\0') {
+        TACSYSLOG((LOG_ERR, "%s: no host in %s", __FUNCTION__, arg))
+        free(buf);
+        return -1;
+    }
+
+    for (; opt != NULL; opt = next) {
+        if ((next = strchr(opt, ',')) != NULL)
+            *next++ = '\0';
+
+        if (!strncmp(opt, "secret=", 7)) {
+            free(s.key);
+            s.key = xstrdup(opt + 7);
+        } else if (!strncmp(opt, "timeout=", 8)) {
+            s.timeout = atoi(opt + 8);
+        } else if (!strncmp(opt, "weight=", 7)) {
+            s.weight = atoi(opt + 7);
+        } else if (!strncmp(opt, "keepalive=", 10)) {
+            s.keepalive = atoi(opt + 10);
+        } else if (!strncmp(opt, "user_timeout=", 13)) {
+            s.user_timeout = atoi(opt + 13);
+        } else if (!strncmp(opt, "group=", 6)) {
+            free(s.group);
+            s.group = xstrdup(opt + 6);
+        } else {
+            TACSYSLOG((LOG_WARNING, "%s: unrecognized server option: %s",\
+                __FUNCTION__, opt))
+        }
+    }
+
+    s.host = xstrdup(host);
+    s.port = (port != NULL) ? xstrdup(port) : NULL;
+    free(buf);
+    if (s.group == NULL)
+        s.group = xstrdup(TAC_PLUS_GROUP_DEFAULT);
+    if (s.weight < 1)
+        s.weight = 1;
+    if (s.weight > TAC_PLUS_MAXWEIGHT)
+        s.weight = TAC_PLUS_MAXWEIGHT;
+
+    spec = (struct tac_srv_spec *) xrealloc(spec,
+        (spec_no + 1) * sizeof(struct tac_srv_spec));
+    spec[spec_no++] = s;
+    return 0;
+}
+
+/* Adds a secret= option; the n-th one goes with the n-th server that
+ * has no secret of its own, servers past the last one use the first.
+ */
+void tac_srvtab_key(const char *key) {
+    spec_key = (char **) xrealloc(spec_key,
+        (spec_key_no + 1) * sizeof(char *));
+    spec_key[spec_key_no++] = xstrdup((char *) key);
+}
+
+static void _tac_srvtab_free(void) {
+    int i;
+
+    for (i = 0; i < tac_server_no; i++) {
+        free(tac_server[i].key);
+        free(tac_server[i].host);
+    }
+    free(tac_server);
+    tac_server = NULL;
+    tac_server_no = 0;
+
+    for (i = 0; i < tac_group_no; i++)
+        free(tac_group[i].name);
+    free(tac_group);
+    tac_group = NULL;
+    tac_group_no = 0;
+}
+
+/* Resolves the servers added since tac_srvtab_reset(), all at once
+ * (see tac_resolve()), and replaces the table with them. Each address
+ * of a name is an entry of its own. Groups keep the order in which
+ * they were first named, servers the order in which they were given.
+ */
+void tac_srvtab_build(void) {
+    char **host, **port, **key;
+    struct addrinfo **res, *a;
+    char tls_port[8];
+    int i, j, g, n;
+
+    _tac_srvtab_free();
+
+    host = (char **) xcalloc(spec_no + 1, sizeof(char *));
+    port = (char **) xcalloc(spec_no + 1, sizeof(char *));
+    key = (char **) xcalloc(spec_no + 1, sizeof(char *));
+    res = (struct addrinfo **) xcalloc(spec_no + 1, sizeof(struct addrinfo *));
+    snprintf(tls_port, sizeof(tls_port), "%d", TAC_PLUS_TLS_PORT);
+    for (i = 0, n = 0; i < spec_no; i++) {
+        host[i] = spec[i].host;
+        port[i] = spec[i].port;
+        if (port[i] == NULL && tac_tls)
+            port[i] = tls_port;
+
+        /* secret= options pair up with servers in the order given */
+        if (spec[i].key != NULL)
+            key[i] = spec[i].key;
+        else if (n < spec_key_no)
+            key[i] = spec_key[n++];
+        else if (spec_key_no > 0)
+            key[i] = spec_key[0];
+        else
+            key[i] = "";
+    }
+    n = 0;
+    tac_resolve(host, port, res, spec_no);
+
+    for (i = 0; i < spec_no; i++) {
+        if (res[i] == NULL) {
+            TACSYSLOG((LOG_ERR, "%s: skip invalid server: %s", __FUNCTION__,\
+                spec[i].host))
+            continue;
+        }
+        for (a = res[i]; a != NULL; a = a->ai_next)
+            n++;
+    }
+    tac_server = (struct tac_server *) xcalloc(n + 1,
+        sizeof(struct tac_server));
+
+    /* one pass per group, so that its servers end up in one run */
+    for (i = 0; i < spec_no; i++) {
+        for (j = 0; j < i; j++) {
+            if (!strcmp(spec[j].group, spec[i].group))
+                break;
+        }
+        if (j < i)
+            continue;   /* group already laid out */
+
+        g = tac_group_no++;
+        tac_group = (struct tac_group *) xrealloc(tac_group,
+            tac_group_no * sizeof(struct tac_group));
+        tac_group[g].name = xstrdup(spec[i].group);
+        tac_group[g].first = tac_server_no;
+
+        for (j = i; j < spec_no; j++) {
+            if (strcmp(spec[j].group, spec[i].group) != 0)
+                continue;
+            for (a = res[j]; a != NULL; a = a->ai_next) {
+                struct tac_server *s = &tac_server[tac_server_no++];
+
+                s->addr = a;
+                s->key = xstrdup(key[j]);
+                s->timeout = spec[j].timeout;
+                s->weight = spec[j].weight;
+                s->keepalive = spec[j].keepalive;
+                s->user_timeout = spec[j].user_timeout;
+                s->host = xstrdup(spec[j].host);
+            }
+        }
+        tac_group[g].no = tac_server_no - tac_group[g].first;
+    }
+
+    free(res);
+    free(key);
+    free(port);
+    free(host);
+}
+
+/* Points *server and *key at the addresses and secrets of group name,
+ * all servers if there is no such group, in table order. The arrays
+ * are valid until the next call; the caller may reorder them.
+ *
+ * return value:
+ *   number of servers
+ */
+int tac_srvtab_group(const char *name, struct addrinfo ***server,
+    char ***key) {
+
+    int i, first = 0, n = tac_server_no;
+
+    if (name == NULL)
+        name = TAC_PLUS_GROUP_DEFAULT;
+    for (i = 0; i < tac_group_no; i++) {
+        if (!strcmp(tac_group[i].name, name)) {
+            first = tac_group[i].first;
+            n = tac_group[i].no;
+            break;
+        }
+    }
+    if (i == tac_group_no && tac_group_no > 1
+        && strcmp(name, TAC_PLUS_GROUP_DEFAULT) != 0) {
+        TACSYSLOG((LOG_ERR, "%s: no server in group %s, using all",\
+            __FUNCTION__, name))
+    }
+
+    sel_srv = (struct addrinfo **) xrealloc(sel_srv,
+        (n + 1) * sizeof(struct addrinfo *));
+    sel_key = (char **) xrealloc(sel_key, (n + 1) * sizeof(char *));
+    for (i = 0; i < n; i++) {
+        sel_srv[i] = tac_server[first + i].addr;
+        sel_key[i] = tac_server[first + i].key;
+    }
+    *server = sel_srv;
+    *key = sel_key;
+    return n;
+}
+
+static struct tac_server *_tac_srvtab_find(struct addrinfo *server) {
+    int i;
+
+    for (i = 0; server != NULL && i < tac_server_no; i++) {
+        struct addrinfo *a = tac_server[i].addr;
+
+        if (a->ai_addrlen == server->ai_addrlen
+            && !memcmp(a->ai_addr, server->ai_addr, a->ai_addrlen))
+            return &tac_server[i];
+    }
+    return NULL;
+}
+
+/* Returns the connect timeout in seconds for server, its own timeout=
+ * if it was given one, tac_timeout otherwise.
+ */
+int tac_srvtab_timeout(struct addrinfo *server) {
+    struct tac_server *s = _tac_srvtab_find(server);
+
+    if (s != NULL && s->timeout > 0)
+        return s->timeout;
+    return tac_timeout;
+}
+
+/* Returns the weight= of server, 1 if it is not in the table */
+int tac_srvtab_weight(struct addrinfo *server) {
+    struct tac_server *s = _tac_srvtab_find(server);
+
+    return s != NULL ? s->weight : 1;
+}
+
+/* Returns the keepalive idle time in seconds for server, its own
+ * keepalive= if it was given one, tac_keepalive otherwise.
+ */
+int tac_srvtab_keepalive(struct addrinfo *server) {
+    struct tac_server *s = _tac_srvtab_find(server);
+
+    if (s != NULL && s->keepalive > 0)
+        return s->keepalive;
+    return tac_keepalive;
+}
+
+/* Returns the TCP user timeout in milliseconds for server, its own
+ * user_timeout= if it was given one, tac_user_timeout otherwise.
+ */
+int tac_srvtab_user_timeout(struct addrinfo *server) {
+    struct tac_server *s = _tac_srvtab_find(server);
+
+    if (s != NULL && s->user_timeout > 0)
+        return s->user_timeout;
+    return tac_user_timeout;
+}
+
+/* Returns the host of server as given in server=, NULL if it is not in
+ * the table.
+ */
+const char *tac_srvtab_host(struct addrinfo *server) {
+    struct tac_server *s = _tac_srvtab_find(server);
+
+    return s != NULL ? s->host : NULL;
+}
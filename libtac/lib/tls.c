@@ -0,0 +1,600 @@
+/* tls.c - TACACS+ over TLS 1.3.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#if defined(HAVE_LIBSSL) && defined(HAVE_OPENSSL_SSL_H)
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+#define TAC_TLS
+#endif
+
+#include "libtac.h"
+#include "xalloc.h"
+
+/* With tac_tls set every connection is wrapped in TLS 1.3 as soon as
+ * TCP is up, as the TACACS+ TLS draft has it: the server certificate
+ * is checked against tac_tls_ca (the system CAs if NULL) and the name
+ * given in server=, a client certificate is offered if tac_tls_cert is
+ * set, and packets go with TAC_PLUS_UNENCRYPTED_FLAG, the MD5 pad and
+ * the secrets are not used (see tac_set_key()).
+ *
+ * The tickets a server sends are kept per address, so the next
+ * connection to it resumes the session without a full handshake. Where
+ * the kernel has kTLS, OpenSSL hands it the record layer after the
+ * handshake and reads and writes go to the socket without a copy
+ * through OpenSSL's buffers.
+ *
+ * All I/O on libtac fds goes through _tac_tls_read() and
+ * _tac_tls_write(), which are plain read() and write() on fds without
+ * TLS.
+ */
+int tac_tls = 0;
+char *tac_tls_ca = NULL;
+char *tac_tls_cert = NULL;
+char *tac_tls_key = NULL;      /* NULL for the key in tac_tls_cert */
+
+#ifdef TAC_TLS
+
+/* a TLS connection of libtac */
+struct tac_tls_conn {
+    int fd;
+    SSL *ssl;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct tac_tls_conn *next;
+};
+
+/* the ticket last received from a server, used up by the next connect */
+struct tac_tls_ticket {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    SSL_SESSION *sess;
+    struct tac_tls_ticket *next;
+};
+
+static struct tac_tls_conn *tls_list = NULL;
+static struct tac_tls_ticket *ticket_list = NULL;
+
+static void _tac_tls_drop(int fd, int notify);
+
+/* the context and the settings it was made with */
+static SSL_CTX *tls_ctx = NULL;
+static char *ctx_ca = NULL, *ctx_cert = NULL, *ctx_key = NULL;
+
+static int _tac_tls_same(const char *a, const char *b) {
+    if (a == NULL || b == NULL)
+        return a == b;
+    return !strcmp(a, b);
+}
+
+static void _tac_tls_error(const char *fn, const char *what) {
+    char buf[256];
+    unsigned long e = ERR_get_error();
+
+    ERR_error_string_n(e, buf, sizeof(buf));
+    TACSYSLOG((LOG_ERR, "%s: %s: %s", fn, what, e ? buf : "error"))
+    ERR_clear_error();
+}
+
+static struct tac_tls_conn *_tac_tls_find(int fd) {
+    struct tac_tls_conn *c;
+
+    for (c = tls_list; c != NULL; c = c->next) {
+        if (c->fd == fd)
+            return c;
+    }
+    return NULL;
+}
+
+static struct tac_tls_ticket *_tac_tls_ticket(struct sockaddr_storage *addr,
+    socklen_t addrlen, int create) {
+
+    struct tac_tls_ticket *t;
+
+    for (t = ticket_list; t != NULL; t = t->next) {
+        if (t->addrlen == addrlen && !memcmp(&t->addr, addr, addrlen))
+            return t;
+    }
+    if (!create)
+        return NULL;
+    t = (struct tac_tls_ticket *) xcalloc(1, sizeof(struct tac_tls_ticket));
+    bcopy(addr, &t->addr, addrlen);
+    t->addrlen = addrlen;
+    t->next = ticket_list;
+    ticket_list = t;
+    return t;
+}
+
+/* A server sent a ticket; keeps it, replacing the one before. OpenSSL
+ * calls this from within SSL_connect() or SSL_read().
+ */
+static int _tac_tls_new_ticket(SSL *ssl, SSL_SESSION *sess) {
+    struct tac_tls_conn *c = (struct tac_tls_conn *) SSL_get_app_data(ssl);
+    struct tac_tls_ticket *t;
+
+    if (c == NULL)
+        return 0;
+    t = _tac_tls_ticket(&c->addr, c->addrlen, 1);
+    if (t->sess != NULL)
+        SSL_SESSION_free(t->sess);
+    t->sess = sess;
+    TACDEBUG((LOG_DEBUG, "%s: ticket for fd=%d", __FUNCTION__, c->fd))
+    return 1;   /* the ticket is ours now */
+}
+
+static void _tac_tls_tickets_free(void) {
+    struct tac_tls_ticket *t;
+
+    while ((t = ticket_list) != NULL) {
+        ticket_list = t->next;
+        if (t->sess != NULL)
+            SSL_SESSION_free(t->sess);
+        free(t);
+    }
+}
+
+/* Frees all TLS state when libtac goes away. It is registered with
+ * atexit() after OpenSSL is set up, so it runs before OpenSSL cleans up
+ * at exit, and before the destructors when the PAM module is unloaded.
+ * No close_notify is sent, the fds may have been inherited over fork().
+ */
+static void _tac_tls_fini(void) {
+    while (tls_list != NULL)
+        _tac_tls_drop(tls_list->fd, 0);
+    _tac_tls_tickets_free();
+    if (tls_ctx != NULL)
+        SSL_CTX_free(tls_ctx);
+    tls_ctx = NULL;
+    free(ctx_ca);
+    free(ctx_cert);
+    free(ctx_key);
+    ctx_ca = ctx_cert = ctx_key = NULL;
+}
+
+/* Returns the context for the current tac_tls_* settings, making a new
+ * one when they changed since the last call; NULL on error.
+ */
+static SSL_CTX *_tac_tls_ctx(void) {
+    static int fini = 0;
+    SSL_CTX *ctx;
+
+    if (tls_ctx != NULL && _tac_tls_same(ctx_ca, tac_tls_ca)
+        && _tac_tls_same(ctx_cert, tac_tls_cert)
+        && _tac_tls_same(ctx_key, tac_tls_key))
+        return tls_ctx;
+
+    if ((ctx = SSL_CTX_new(TLS_client_method())) == NULL) {
+        _tac_tls_error(__FUNCTION__, "SSL_CTX_new");
+        return NULL;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+        | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+        | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, _tac_tls_new_ticket);
+
+    if ((tac_tls_ca != NULL
+            ? SSL_CTX_load_verify_locations(ctx, tac_tls_ca, NULL)
+            : SSL_CTX_set_default_verify_paths(ctx)) != 1) {
+        _tac_tls_error(__FUNCTION__, tac_tls_ca != NULL ? tac_tls_ca
+            : "default CA paths");
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    if (tac_tls_cert != NULL
+        && (SSL_CTX_use_certificate_chain_file(ctx, tac_tls_cert) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, tac_tls_key != NULL
+                ? tac_tls_key : tac_tls_cert, SSL_FILETYPE_PEM) != 1
+            || SSL_CTX_check_private_key(ctx) != 1)) {
+        _tac_tls_error(__FUNCTION__, tac_tls_cert);
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+
+    /* connections made with the old one keep it until they close */
+    if (tls_ctx != NULL)
+        SSL_CTX_free(tls_ctx);
+    _tac_tls_tickets_free();
+    free(ctx_ca);
+    free(ctx_cert);
+    free(ctx_key);
+    ctx_ca = tac_tls_ca != NULL ? xstrdup(tac_tls_ca) : NULL;
+    ctx_cert = tac_tls_cert != NULL ? xstrdup(tac_tls_cert) : NULL;
+    ctx_key = tac_tls_key != NULL ? xstrdup(tac_tls_key) : NULL;
+    tls_ctx = ctx;
+    if (!fini)
+        fini = atexit(_tac_tls_fini) == 0;
+    return ctx;
+}
+
+/* Sets up TLS on the connected fd to server, without handshaking yet */
+static struct tac_tls_conn *_tac_tls_new(SSL_CTX *ctx, int fd,
+    struct addrinfo *server) {
+
+    struct tac_tls_conn *c;
+    struct tac_tls_ticket *t;
+    const char *host = tac_srvtab_host(server);
+    u_char ip[sizeof(struct in6_addr)];
+    SSL *ssl;
+
+    if ((ssl = SSL_new(ctx)) == NULL || SSL_set_fd(ssl, fd) != 1) {
+        _tac_tls_error(__FUNCTION__, "SSL_new");
+        SSL_free(ssl);
+        return NULL;
+    }
+
+    /* the certificate has to be for the name or address in server=, or
+     * for the address connected to when server is not in the table
+     */
+    if (host == NULL) {
+        const u_char *addr = NULL;
+        size_t len = 0;
+
+        if (server->ai_family == AF_INET) {
+            addr = (const u_char *)
+                &((struct sockaddr_in *) server->ai_addr)->sin_addr;
+            len = sizeof(struct in_addr);
+        } else if (server->ai_family == AF_INET6) {
+            addr = (const u_char *)
+                &((struct sockaddr_in6 *) server->ai_addr)->sin6_addr;
+            len = sizeof(struct in6_addr);
+        }
+        if (addr == NULL
+            || X509_VERIFY_PARAM_set1_ip(SSL_get0_param(ssl), addr, len) != 1) {
+            TACSYSLOG((LOG_ERR, "%s: no name or address to check the"\
+                " certificate against", __FUNCTION__))
+            SSL_free(ssl);
+            return NULL;
+        }
+    } else if (inet_pton(AF_INET, host, ip) == 1
+        || inet_pton(AF_INET6, host, ip) == 1) {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host);
+    } else {
+        SSL_set_tlsext_host_name(ssl, host);
+        SSL_set1_host(ssl, host);
+    }
+
+    c = (struct tac_tls_conn *) xcalloc(1, sizeof(struct tac_tls_conn));
+    c->fd = fd;
+    c->ssl = ssl;
+    if (server->ai_addrlen <= sizeof(c->addr)) {
+        bcopy(server->ai_addr, &c->addr, server->ai_addrlen);
+        c->addrlen = server->ai_addrlen;
+    }
+    SSL_set_app_data(ssl, c);
+
+    /* tickets are for one use only */
+    t = _tac_tls_ticket(&c->addr, c->addrlen, 0);
+    if (t != NULL && t->sess != NULL) {
+        if (SSL_SESSION_is_resumable(t->sess))
+            SSL_set_session(ssl, t->sess);
+        SSL_SESSION_free(t->sess);
+        t->sess = NULL;
+    }
+
+    c->next = tls_list;
+    tls_list = c;
+    return c;
+}
+
+/* Forgets the TLS state of fd, telling the server when notify is set */
+static void _tac_tls_drop(int fd, int notify) {
+    struct tac_tls_conn **cp, *c;
+
+    for (cp = &tls_list; *cp != NULL; cp = &(*cp)->next) {
+        if ((*cp)->fd == fd)
+            break;
+    }
+    if ((c = *cp) == NULL)
+        return;
+    *cp = c->next;
+    /* close_notify, not waiting for the server's */
+    if (notify && SSL_is_init_finished(c->ssl))
+        SSL_shutdown(c->ssl);
+    SSL_free(c->ssl);
+    ERR_clear_error();
+    free(c);
+}
+
+static void _tac_tls_done(struct tac_tls_conn *c) {
+    char *ip = tac_ntop((struct sockaddr *) &c->addr, 0);
+    int ktx = 0, krx = 0;
+
+#ifdef SSL_OP_ENABLE_KTLS
+    ktx = BIO_get_ktls_send(SSL_get_wbio(c->ssl));
+    krx = BIO_get_ktls_recv(SSL_get_rbio(c->ssl));
+#endif
+    TACDEBUG((LOG_DEBUG, "%s: %s with %s, %s, %s%s%s", __FUNCTION__,\
+        SSL_get_version(c->ssl), ip, SSL_get_cipher_name(c->ssl),\
+        SSL_session_reused(c->ssl) ? "resumed" : "full handshake",\
+        ktx ? ", kTLS send" : "", krx ? ", kTLS receive" : ""))
+    free(ip);
+}
+
+#endif /* TAC_TLS */
+
+/* Does the TLS handshake on the n connected fds to server[i], all at
+ * once, each within the server's timeout and the transaction deadline.
+ * fd[i] < 0 and fds already running TLS are left alone. An fd whose
+ * handshake fails is closed and fd[i] gets a negative status code.
+ *
+ * return value:
+ *   number of fds ready for use
+ */
+int tac_tls_connect(int *fd, struct addrinfo **server, int n) {
+    int i, ready = 0;
+#ifdef TAC_TLS
+    struct tac_tls_conn **conn;
+    struct pollfd *pfd;
+    long *deadline;
+    int *pfd_conn;
+    int active = 0;
+    SSL_CTX *ctx = _tac_tls_ctx();
+
+    conn = (struct tac_tls_conn **) xcalloc(n + 1,
+        sizeof(struct tac_tls_conn *));
+    deadline = (long *) xcalloc(n + 1, sizeof(long));
+    pfd = (struct pollfd *) xcalloc(n + 1, sizeof(struct pollfd));
+    pfd_conn = (int *) xcalloc(n + 1, sizeof(int));
+
+    for (i = 0; i < n; i++) {
+        if (fd[i] < 0 || _tac_tls_find(fd[i]) != NULL)
+            continue;
+        if (ctx == NULL || (conn[i] = _tac_tls_new(ctx, fd[i],
+            server[i])) == NULL) {
+            close(fd[i]);
+            fd[i] = LIBTAC_STATUS_CONN_ERR;
+            continue;
+        }
+        deadline[i] = _tac_now_msecs()
+            + _tac_time_left(tac_srvtab_timeout(server[i])*1000);
+        active++;
+    }
+
+    while (active > 0) {
+        int timeout = -1, m = 0, rc, r;
+        long now = _tac_now_msecs();
+
+        for (i = 0; i < n; i++) {
+            struct tac_tls_conn *c = conn[i];
+
+            if (c == NULL)
+                continue;
+            if (now >= deadline[i]) {
+                char *ip = tac_ntop(server[i]->ai_addr, 0);
+
+                TACSYSLOG((LOG_ERR, "%s: TLS handshake with %s timed out",\
+                    __FUNCTION__, ip))
+                free(ip);
+                r = LIBTAC_STATUS_CONN_TIMEOUT;
+                goto failed;
+            }
+
+            ERR_clear_error();
+            r = SSL_connect(c->ssl);
+            if (r == 1) {
+                _tac_tls_done(c);
+                conn[i] = NULL;
+                active--;
+                continue;
+            }
+            switch (SSL_get_error(c->ssl, r)) {
+                case SSL_ERROR_WANT_READ:
+                    pfd[m].events = POLLIN;
+                    break;
+                case SSL_ERROR_WANT_WRITE:
+                    pfd[m].events = POLLOUT;
+                    break;
+                default: {
+                    char *ip = tac_ntop(server[i]->ai_addr, 0);
+                    long v = SSL_get_verify_result(c->ssl);
+
+                    if (v != X509_V_OK) {
+                        TACSYSLOG((LOG_ERR, "%s: certificate of %s: %s",\
+                            __FUNCTION__, ip,\
+                            X509_verify_cert_error_string(v)))
+                    } else {
+                        _tac_tls_error(__FUNCTION__, ip);
+                    }
+                    free(ip);
+                    r = LIBTAC_STATUS_CONN_ERR;
+                    goto failed;
+                }
+            }
+            pfd[m].fd = fd[i];
+            pfd[m].revents = 0;
+            pfd_conn[m++] = i;
+            if (timeout < 0 || deadline[i] - now < timeout)
+                timeout = (int)(deadline[i] - now);
+            continue;
+
+        failed:
+            tac_health_connect(server[i], -1);
+            _tac_tls_drop(fd[i], 0);
+            close(fd[i]);
+            fd[i] = r;
+            conn[i] = NULL;
+            active--;
+        }
+        if (m == 0)
+            continue;
+
+        rc = poll(pfd, m, timeout);
+        if (rc < 0 && errno != EINTR) {
+            TACSYSLOG((LOG_ERR, "%s: poll failed: %m", __FUNCTION__))
+            for (i = 0; i < m; i++) {
+                int k = pfd_conn[i];
+
+                _tac_tls_drop(fd[k], 0);
+                close(fd[k]);
+                fd[k] = LIBTAC_STATUS_CONN_ERR;
+                conn[k] = NULL;
+            }
+            break;
+        }
+    }
+
+    free(pfd_conn);
+    free(pfd);
+    free(deadline);
+    free(conn);
+#else
+    (void) server;
+    TACSYSLOG((LOG_ERR, "%s: built without TLS support", __FUNCTION__))
+    for (i = 0; i < n; i++) {
+        if (fd[i] >= 0) {
+            close(fd[i]);
+            fd[i] = LIBTAC_STATUS_CONN_ERR;
+        }
+    }
+#endif
+    for (i = 0; i < n; i++) {
+        if (fd[i] >= 0)
+            ready++;
+    }
+    return ready;
+}    /* tac_tls_connect */
+
+/* Returns 1 if fd runs TLS */
+int tac_tls_active(int fd) {
+#ifdef TAC_TLS
+    return _tac_tls_find(fd) != NULL;
+#else
+    (void) fd;
+    return 0;
+#endif
+}
+
+/* read() for libtac fds, through TLS where fd has it; a TLS fd that
+ * needs to wait fails with EAGAIN whichever way it waits, the callers
+ * wait for what they were doing.
+ */
+ssize_t _tac_tls_read(int fd, void *buf, size_t len) {
+#ifdef TAC_TLS
+    struct tac_tls_conn *c;
+    int r;
+
+    if (tls_list != NULL && (c = _tac_tls_find(fd)) != NULL) {
+        ERR_clear_error();
+        errno = 0;
+        if ((r = SSL_read(c->ssl, buf, len)) > 0)
+            return r;
+        switch (SSL_get_error(c->ssl, r)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_ZERO_RETURN:
+                return 0;
+            case SSL_ERROR_SYSCALL:
+                /* errno 0: the server went away without close_notify */
+                return errno ? -1 : 0;
+            default:
+                _tac_tls_error(__FUNCTION__, "SSL_read");
+                errno = EIO;
+                return -1;
+        }
+    }
+#endif
+    return read(fd, buf, len);
+}
+
+/* write() for libtac fds, see _tac_tls_read() */
+ssize_t _tac_tls_write(int fd, const void *buf, size_t len) {
+#ifdef TAC_TLS
+    struct tac_tls_conn *c;
+    int r;
+
+    if (tls_list != NULL && (c = _tac_tls_find(fd)) != NULL) {
+        ERR_clear_error();
+        errno = 0;
+        if ((r = SSL_write(c->ssl, buf, len)) > 0)
+            return r;
+        switch (SSL_get_error(c->ssl, r)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_SYSCALL:
+                if (errno == 0)
+                    errno = EPIPE;
+                return -1;
+            default:
+                _tac_tls_error(__FUNCTION__, "SSL_write");
+                errno = EIO;
+                return -1;
+        }
+    }
+#endif
+    return write(fd, buf, len);
+}
+
+/* tac_alive() for a TLS fd: takes in tickets that arrived meanwhile.
+ *
+ * return value:
+ *      1 : alive
+ *      0 : closed, failed or application data waiting
+ *     -1 : fd does not run TLS
+ */
+int _tac_tls_alive(int fd) {
+#ifdef TAC_TLS
+    struct tac_tls_conn *c;
+    char ch;
+    int r;
+
+    if (tls_list == NULL || (c = _tac_tls_find(fd)) == NULL)
+        return -1;
+    ERR_clear_error();
+    r = SSL_peek(c->ssl, &ch, 1);
+    if (r <= 0 && SSL_get_error(c->ssl, r) == SSL_ERROR_WANT_READ) {
+        ERR_clear_error();
+        return 1;
+    }
+    ERR_clear_error();
+    return 0;
+#else
+    (void) fd;
+    return -1;
+#endif
+}
+
+/* Drops the TLS state of fd before it is closed; the server is sent a
+ * close_notify when notify is set, which a process that inherited the
+ * fd over fork() must not do.
+ */
+void _tac_tls_close(int fd, int notify) {
+#ifdef TAC_TLS
+    if (tls_list != NULL)
+        _tac_tls_drop(fd, notify);
+#else
+    (void) fd;
+    (void) notify;
+#endif
+}
@@ -33,6 +33,8 @@
 #include <ctype.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 
 #ifndef __linux__
     #include <strings.h>
@@ -41,6 +43,7 @@
 #include "libtac.h"
 #include "pam_tacplus.h"
 #include "support.h"
+#include "broker.h"
 
 #define PAM_SM_AUTH
 #define PAM_SM_ACCOUNT
@@ -56,12 +59,18 @@
 #endif
 
 /* support.c */
-extern struct addrinfo *tac_srv[TAC_PLUS_MAXSERVERS];
-extern char *tac_srv_key[TAC_PLUS_MAXSERVERS];
+extern struct addrinfo **tac_srv;
+extern char **tac_srv_key;
 extern int tac_srv_no;
+extern char *tac_author_group;
+extern char *tac_acct_group;
 extern char *tac_service;
 extern char *tac_protocol;
+extern char *tac_broker;
+extern int tac_hedge_delay;
 extern int _pam_parse (int argc, const char **argv);
+extern void _pam_group (const char *group);
+extern void _pam_balance (const char *user);
 extern unsigned long _getserveraddr (char *serv);
 extern int tacacs_get_password (pam_handle_t * pamh, int flags
     ,int ctrl, char **password);
@@ -74,23 +83,229 @@ extern void *_xcalloc (size_t size);
 /* magic.c */
 extern u_int32_t magic();
 
-/* address of server discovered by pam_sm_authenticate */
+/* address of server discovered by pam_sm_authenticate; a copy, as
+   the resolver may replace tac_srv[] entries before pam_sm_acct_mgmt */
 static struct addrinfo *active_server;
+static struct addrinfo active_server_ai;
+static struct sockaddr_storage active_server_addr;
 char *active_key;
+/* set when pam_sm_authenticate was answered by tacplusd */
+static int active_broker = 0;
 /* accounting task identifier */
 static short int task_id = 0;
+/* connection to tac_srv[0] opened while the user types the password;
+   spec_pending is set while its handshake may still be in progress */
+static int spec_fd = -1;
+static int spec_pending = 0;
 
 
 /* Helper functions */
-int _pam_send_account(int tac_fd, int type, const char *user, char *tty,
-    char *r_addr, char *cmd) {
 
+/* Remembers server srv_i as the one that authenticated the user */
+static void _pam_set_active(int srv_i) {
+    active_server_ai = *tac_srv[srv_i];
+    bcopy(tac_srv[srv_i]->ai_addr, &active_server_addr,
+        tac_srv[srv_i]->ai_addrlen);
+    active_server_ai.ai_addr = (struct sockaddr *) &active_server_addr;
+    active_server_ai.ai_canonname = NULL;
+    active_server_ai.ai_next = NULL;
+    active_server = &active_server_ai;
+    /* the server table, and the keys in it, is rebuilt on each call */
+    free(active_key);
+    active_key = strdup(tac_srv_key[srv_i]);
+}
+
+/* Gets a connection to the first server going before the password
+ * prompt, so its handshake overlaps with the user typing. A pooled
+ * connection is taken as it is.
+ */
+static void _pam_spec_start(int ctrl) {
+    spec_pending = 0;
+    if (tac_broker != NULL || tac_srv_no == 0)
+        return;
+
+    if ((spec_fd = tac_pool_get(tac_srv[0], tac_srv_key[0])) < 0) {
+        spec_fd = tac_connect_start(tac_srv[0]);
+        spec_pending = spec_fd >= 0;
+    }
+    if (spec_fd >= 0 && (ctrl & PAM_TAC_DEBUG))
+        _pam_log(LOG_DEBUG, "%s: %s connection to srv 0 early", __FUNCTION__,
+            spec_pending ? "started" : "took pooled");
+}
+
+/* Drops the early connection if it was not used: a pooled one goes
+ * back to the pool, one still connecting is closed.
+ */
+static void _pam_spec_abandon(void) {
+    if (spec_fd < 0)
+        return;
+    if (spec_pending)
+        close(spec_fd);
+    else
+        tac_pool_put(spec_fd, tac_srv[0], tac_srv_key[0]);
+    spec_fd = -1;
+}
+
+/* Connects to the first available server, starting at tac_srv[*srv_i].
+ * In parallel_connect mode all the remaining servers are raced at once
+ * and *srv_i is moved to the one that answered; if none did, *srv_i is
+ * moved to the last server so the caller's failover loop terminates.
+ * *reused is set when the connection was made before this call, out of
+ * the pool or while the user typed, and may have gone stale since.
+ */
+static int _pam_connect(int ctrl, int *srv_i, int *reused) {
+    int fd, i, winner = 0;
+
+    /* started before the password prompt, see _pam_spec_start() */
+    if (spec_fd >= 0 && *srv_i == 0) {
+        fd = spec_fd;
+        spec_fd = -1;
+        if (spec_pending)
+            fd = tac_connect_finish(fd, tac_srv[0], tac_srv_key[0], 0);
+        else
+            tac_set_key(tac_srv_key[0]);
+        /* the prompt has no time limit, the server may have given up */
+        if (fd < 0 || tac_alive(fd)) {
+            *reused = (fd >= 0);
+            return fd;
+        }
+        if (ctrl & PAM_TAC_DEBUG)
+            _pam_log(LOG_DEBUG, "%s: early connection to srv 0 is dead",
+                __FUNCTION__);
+        tac_close(fd);
+    }
+
+    /* a warm connection would win the race anyway */
+    for (i = *srv_i; i < tac_srv_no; i++) {
+        if ((fd = tac_pool_get(tac_srv[i], tac_srv_key[i])) >= 0) {
+            *srv_i = i;
+            *reused = 1;
+            return fd;
+        }
+        if (!(ctrl & PAM_TAC_PARALLEL))
+            break;
+    }
+    *reused = 0;
+
+    if (!(ctrl & PAM_TAC_PARALLEL) || tac_srv_no - *srv_i < 2)
+        return tac_connect_single(tac_srv[*srv_i], tac_srv_key[*srv_i]);
+
+    fd = tac_connect_parallel(&tac_srv[*srv_i], &tac_srv_key[*srv_i],
+        tac_srv_no - *srv_i, &winner);
+    if (fd < 0)
+        *srv_i = tac_srv_no - 1;
+    else
+        *srv_i += winner;
+    return fd;
+}
+
+/* Time given to tacplusd to answer, enough to go through all servers
+   but not more than is left of deadline_ms */
+#define _pam_broker_timeout() \
+    _tac_time_left(tac_timeout * 1000 * (tac_srv_no > 0 ? tac_srv_no : 1))
+
+/* Authenticates through the tacplusd broker.
+ * Returns a PAM status, or -1 if the broker is not running or the server
+ * asked for data only the user can supply; the caller then talks to the
+ * servers itself.
+ */
+static int _pam_broker_authen(int ctrl, const char *user, char *pass,
+    char *tty, char *r_addr) {
+
+    struct tacd_msg req, rep;
+    int i, status;
+
+    bzero(&req, sizeof(req));
+    req.op = TACD_OP_AUTHEN;
+    tacd_add_arg(&req, user);
+    tacd_add_arg(&req, pass);
+    tacd_add_arg(&req, tty);
+    tacd_add_arg(&req, r_addr);
+
+    status = tacd_call(tac_broker, &req, &rep, _pam_broker_timeout());
+    tacd_free_msg(&req);
+    if (status < 0 || rep.argc < 2) {
+        _pam_log(LOG_WARNING, "%s: broker %s unavailable, connecting directly",
+            __FUNCTION__, tac_broker);
+        tacd_free_msg(&rep);
+        return -1;
+    }
+
+    if (ctrl & PAM_TAC_DEBUG)
+        _pam_log(LOG_DEBUG, "%s: broker status=%d server=%s", __FUNCTION__,
+            rep.arg, rep.argv[1]);
+
+    if (rep.arg == TAC_PLUS_AUTHEN_STATUS_GETDATA) {
+        status = -1;
+    } else if (rep.arg == TAC_PLUS_AUTHEN_STATUS_PASS) {
+        status = PAM_SUCCESS;
+        active_broker = 1;
+        /* remember the server in case the broker goes away before
+           pam_sm_acct_mgmt */
+        for (i = 0; i < tac_srv_no; i++) {
+            char *addr = tac_ntop(tac_srv[i]->ai_addr, tac_srv[i]->ai_addrlen);
+            int match = !strcmp(addr, rep.argv[1]);
+
+            free(addr);
+            if (match) {
+                _pam_set_active(i);
+                break;
+            }
+        }
+    } else if (rep.arg < 0) {
+        _pam_log (LOG_ERR, "no more servers to connect");
+        status = PAM_AUTHINFO_UNAVAIL;
+    } else {
+        _pam_log (LOG_ERR, "auth failed: %d", rep.arg);
+        status = PAM_AUTH_ERR;
+    }
+
+    tacd_free_msg(&rep);
+    return status;
+}
+
+/* Authorizes through the tacplusd broker, filling arep as
+ * tac_author_read() would.
+ * Returns 0 on success, -1 if the broker is not available.
+ */
+static int _pam_broker_author(int ctrl, const char *user, char *tty,
+    char *r_addr, struct tac_attrib *attr, struct areply *arep) {
+
+    struct tacd_msg req, rep;
+    int status;
+
+    bzero(&req, sizeof(req));
+    req.op = TACD_OP_AUTHOR;
+    tacd_add_arg(&req, user);
+    tacd_add_arg(&req, tty);
+    tacd_add_arg(&req, r_addr);
+    tacd_add_attrib_args(&req, attr);
+
+    status = tacd_call(tac_broker, &req, &rep, _pam_broker_timeout());
+    tacd_free_msg(&req);
+    if (status < 0 || rep.argc < 1) {
+        _pam_log(LOG_WARNING, "%s: broker %s unavailable, connecting directly",
+            __FUNCTION__, tac_broker);
+        tacd_free_msg(&rep);
+        return -1;
+    }
+
+    if (ctrl & PAM_TAC_DEBUG)
+        _pam_log(LOG_DEBUG, "%s: broker status=%d", __FUNCTION__, rep.arg);
+
+    arep->status = rep.arg;
+    arep->msg = (*rep.argv[0] != '\0') ? strdup(rep.argv[0]) : NULL;
+    arep->attr = NULL;
+    tacd_args_attrib(&rep, 1, &arep->attr);
+
+    tacd_free_msg(&rep);
+    return 0;
+}
+
+static struct tac_attrib *_pam_acct_attrib(int type, char *cmd) {
     char buf[40];
-    struct tac_attrib *attr;
-    int retval;
-        
-    attr=(struct tac_attrib *)_xcalloc(sizeof(struct tac_attrib));
-        
+    struct tac_attrib *attr = NULL;
+
 #ifdef _AIX
     sprintf(buf, "%d", time(0));
 #else
@@ -109,7 +324,147 @@ int _pam_send_account(int tac_fd, int type, const char *user, char *tty,
     if (cmd != NULL) {
         tac_add_attrib(&attr, "cmd", cmd);
     }
+    return attr;
+}
+
+/* Sends accounting through the tacplusd broker.
+ * Returns a PAM status, or -1 if the broker is not available.
+ */
+static int _pam_broker_acct(int ctrl, int type, const char *user, char *tty,
+    char *r_addr, char *cmd) {
+
+    struct tacd_msg req, rep;
+    struct tac_attrib *attr;
+    int status;
+
+    bzero(&req, sizeof(req));
+    req.op = TACD_OP_ACCT;
+    req.arg = type | ((ctrl & PAM_TAC_ACCT) ? TACD_ACCT_ALL : 0);
+    tacd_add_arg(&req, user);
+    tacd_add_arg(&req, tty);
+    tacd_add_arg(&req, r_addr);
+    attr = _pam_acct_attrib(type, cmd);
+    tacd_add_attrib_args(&req, attr);
+    tac_free_attrib(&attr);
+
+    status = tacd_call(tac_broker, &req, &rep, _pam_broker_timeout());
+    tacd_free_msg(&req);
+    if (status < 0) {
+        _pam_log(LOG_WARNING, "%s: broker %s unavailable, connecting directly",
+            __FUNCTION__, tac_broker);
+        return -1;
+    }
+
+    if (rep.arg == TAC_PLUS_ACCT_STATUS_SUCCESS) {
+        status = PAM_SUCCESS;
+    } else {
+        _pam_log (LOG_WARNING, "%s: accounting %s failed (task %hu)",
+            __FUNCTION__, tac_acct_flag2str(type), task_id);
+        status = PAM_SESSION_ERR;
+    }
+
+    tacd_free_msg(&rep);
+    return status;
+}
+
+/* Connects to the first available server, see _pam_connect(), and sends
+ * the AUTHEN/START. If the reply is late, i.e. not there after
+ * tac_hedge_delay milliseconds (or, with hedge=auto, later than usual
+ * for that server), the same START is sent to the next server as well,
+ * as long as the retry budget allows. The connection that answers first
+ * is returned, ready for tac_authen_read(), with session_id and the key
+ * set for it and *srv_i moved to its server; the other one is closed.
+ * *reused is as for _pam_connect(), for the connection returned or, on
+ * error, the one the START could not be sent on.
+ * Only used for PAP and CHAP, which take a single round trip.
+ *
+ * return value:
+ *   >= 0 : valid fd
+ *   <  0 : error status code, see LIBTAC_STATUS_...
+ */
+static int _pam_hedged_start(int ctrl, const char *user, char *pass,
+    char *tty, char *r_addr, int *srv_i, int *reused) {
+
+    struct pollfd pfd[2];
+    int srv[2], sid[2];
+    int n = 1, delay, rc, win = 0;
+
+    pfd[0].fd = _pam_connect(ctrl, srv_i, reused);
+    if (pfd[0].fd < 0)
+        return pfd[0].fd;
+    pfd[0].events = POLLIN;
+    srv[0] = *srv_i;
+
+    if (tac_authen_send(pfd[0].fd, user, pass, tty, r_addr,
+        TAC_PLUS_AUTHEN_LOGIN, ctrl) < 0) {
+        tac_close(pfd[0].fd);
+        return LIBTAC_STATUS_WRITE_ERR;
+    }
+    sid[0] = session_id;
+    tac_health_budget_earn();
+
+    delay = tac_hedge_delay;
+    if (delay < 0)
+        delay = tac_health_reply_limit(tac_srv[srv[0]]);
+    if (delay < 0 || srv[0] + 1 >= tac_srv_no)
+        return pfd[0].fd;
+
+    /* no time left to hedge within deadline_ms */
+    if (delay >= _tac_time_left(-1) && tac_deadline != 0)
+        return pfd[0].fd;
 
+    while ((rc = poll(pfd, 1, delay)) < 0 && errno == EINTR)
+        ;
+    if (rc != 0)
+        return pfd[0].fd;
+
+    if (!tac_health_budget_spend()) {
+        if (ctrl & PAM_TAC_DEBUG)
+            _pam_log(LOG_DEBUG, "%s: reply late, retry budget exhausted",
+                __FUNCTION__);
+        return pfd[0].fd;
+    }
+
+    srv[1] = srv[0] + 1;
+    pfd[1].fd = tac_connect_pooled(tac_srv[srv[1]], tac_srv_key[srv[1]]);
+    pfd[1].events = POLLIN;
+    if (pfd[1].fd >= 0) {
+        if (tac_authen_send(pfd[1].fd, user, pass, tty, r_addr,
+            TAC_PLUS_AUTHEN_LOGIN, ctrl) < 0) {
+            tac_close(pfd[1].fd);
+        } else {
+            sid[1] = session_id;
+            n = 2;
+            if (ctrl & PAM_TAC_DEBUG)
+                _pam_log(LOG_DEBUG, "%s: no reply from srv %d after %d ms, "
+                    "hedged to srv %d", __FUNCTION__, srv[0], delay, srv[1]);
+        }
+    }
+
+    if (n == 2) {
+        while ((rc = poll(pfd, n, _tac_time_left(tac_readtimeout_enable ?
+            tac_timeout*1000 : -1))) < 0 && errno == EINTR)
+            ;
+        if (rc > 0 && pfd[0].revents == 0) {
+            win = 1;
+            *reused = 0;
+        }
+        tac_close(pfd[1 - win].fd);
+    }
+
+    session_id = sid[win];
+    tac_set_key(tac_srv_key[srv[win]]);
+    *srv_i = srv[win];
+    return pfd[win].fd;
+}
+
+int _pam_send_account(int tac_fd, int type, const char *user, char *tty,
+    char *r_addr, char *cmd) {
+
+    struct tac_attrib *attr;
+    int retval;
+
+    attr = _pam_acct_attrib(type, cmd);
     retval = tac_acct_send(tac_fd, type, user, tty, r_addr, attr);
 
     /* this is no longer needed */
@@ -120,7 +475,6 @@ int _pam_send_account(int tac_fd, int type, const char *user, char *tty,
             __FUNCTION__, 
             tac_acct_flag2str(type),
             task_id);
-        close(tac_fd);
         return -1;
     }
         
@@ -131,12 +485,10 @@ int _pam_send_account(int tac_fd, int type, const char *user, char *tty,
             tac_acct_flag2str(type),
             task_id);
         if(re.msg != NULL) free(re.msg);
-        close(tac_fd);
         return -1;
     }
 
     if(re.msg != NULL) free(re.msg);
-    close(tac_fd);
     return 0;
 }
 
@@ -153,6 +505,7 @@ int _pam_account(pam_handle_t *pamh, int argc, const char **argv,
   
     typemsg = tac_acct_flag2str(type);
     ctrl = _pam_parse (argc, argv);
+    _pam_group(tac_acct_group);
 
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: [%s] called (pam_tacplus v%u.%u.%u)"
@@ -165,6 +518,9 @@ int _pam_account(pam_handle_t *pamh, int argc, const char **argv,
 
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log(LOG_DEBUG, "%s: username [%s] obtained", __FUNCTION__, user);
+
+    /* server to start with, for load balancing */
+    _pam_balance(user);
   
     tty = _pam_get_terminal(pamh);
     if(!strncmp(tty, "/dev/", 5)) 
@@ -198,15 +554,18 @@ int _pam_account(pam_handle_t *pamh, int argc, const char **argv,
         signal(SIGHUP, SIG_IGN);
     }
 
-    if(!(ctrl & PAM_TAC_ACCT)) {
+    if (tac_broker != NULL
+        && (status = _pam_broker_acct(ctrl, type, user, tty, r_addr, cmd)) >= 0) {
+        /* sent by tacplusd */
+    } else if(!(ctrl & PAM_TAC_ACCT)) {
     /* normal mode, send packet to the first available server */
         int srv_i = 0;
                   
         status = PAM_SESSION_ERR;
         while ((status == PAM_SESSION_ERR) && (srv_i < tac_srv_no)) {
-            int tac_fd;
+            int tac_fd, reused;
                                   
-            tac_fd = tac_connect_single(tac_srv[srv_i], tac_srv_key[srv_i]);
+            tac_fd = _pam_connect(ctrl, &srv_i, &reused);
             if(tac_fd < 0) {
                 _pam_log(LOG_WARNING, "%s: error sending %s (fd)",
                     __FUNCTION__, typemsg);
@@ -230,42 +589,40 @@ int _pam_account(pam_handle_t *pamh, int argc, const char **argv,
                     _pam_log(LOG_DEBUG, "%s: [%s] for [%s] sent",
                         __FUNCTION__, typemsg,user);
             }
-            close(tac_fd);
+            if (retval < 0)
+                tac_close(tac_fd);
+            else
+                tac_pool_put(tac_fd, tac_srv[srv_i], tac_srv_key[srv_i]);
+            /* the pooled connection went stale, retry on a new one */
+            if (retval < 0 && reused)
+                continue;
             srv_i++;
         }
     } else {
-        /* send packet to all servers specified */
+        /* send packet to all servers specified, all at once */
+        struct tac_attrib *attr;
+        int *srv_status;
         int srv_i;
-                  
-        status = PAM_SESSION_ERR;
-        for(srv_i = 0; srv_i < tac_srv_no; srv_i++) {
-            int tac_fd;
-                                  
-            tac_fd = tac_connect_single(tac_srv[srv_i], tac_srv_key[srv_i]);
-            if(tac_fd < 0) {
-                _pam_log(LOG_WARNING, "%s: error sending %s (fd)",
-                    __FUNCTION__, typemsg);
-                continue;
-            }
-
-            if (ctrl & PAM_TAC_DEBUG)
-                _pam_log(LOG_DEBUG, "%s: connected with fd=%d (srv %d)", __FUNCTION__, tac_fd, srv_i);
 
-            retval = _pam_send_account(tac_fd, type, user, tty, r_addr, cmd);
-            /* return code from function in this mode is
-               status of the last server we tried to send
-               packet to */
-            if(retval < 0) {
-                _pam_log(LOG_WARNING, "%s: error sending %s (acct)",
-                    __FUNCTION__, typemsg);
-            } else {
-                status = PAM_SUCCESS;
-                if (ctrl & PAM_TAC_DEBUG) 
-                    _pam_log(LOG_DEBUG, "%s: [%s] for [%s] sent",
-                        __FUNCTION__, typemsg,user);
-            }
-            close(tac_fd);
+        srv_status = (int *) _xcalloc((tac_srv_no + 1) * sizeof(int));
+        attr = _pam_acct_attrib(type, cmd);
+        status = tac_acct_all(type, user, tty, r_addr, attr, tac_srv,
+            tac_srv_key, tac_srv_no, srv_status) > 0
+            ? PAM_SUCCESS : PAM_SESSION_ERR;
+        tac_free_attrib(&attr);
+
+        for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+            char *ip = tac_ntop(tac_srv[srv_i]->ai_addr, 0);
+
+            if (srv_status[srv_i] != TAC_PLUS_ACCT_STATUS_SUCCESS)
+                _pam_log(LOG_WARNING, "%s: %s to %s failed: %d (task %hu)",
+                    __FUNCTION__, typemsg, ip, srv_status[srv_i], task_id);
+            else if (ctrl & PAM_TAC_DEBUG)
+                _pam_log(LOG_DEBUG, "%s: [%s] for [%s] sent to %s",
+                    __FUNCTION__, typemsg, user, ip);
+            free(ip);
         }
+        free(srv_status);
     }  /* acct mode */
 
     if(type == TAC_PLUS_ACCT_FLAG_STOP) {
@@ -293,9 +650,10 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
     char *tty;
     char *r_addr;
     int srv_i;
-    int tac_fd;
+    int tac_fd, reused;
     int status = PAM_AUTH_ERR;
     int seq = 0;
+    int hedge;
 
     user = pass = tty = r_addr = NULL;
 
@@ -310,25 +668,40 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
 
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: user [%s] obtained", __FUNCTION__, user);
+
+    /* server to start with, for load balancing */
+    _pam_balance(user);
+
+    /* ASCII login is a conversation, only PAP and CHAP are hedged */
+    hedge = tac_hedge_delay != 0
+        && (tac_login == NULL || strcmp(tac_login, "login") != 0);
   
+    /* connect while the user types */
+    _pam_spec_start(ctrl);
+
     /* uwzgledniac PAM_DISALLOW_NULL_AUTHTOK */
 
     retval = tacacs_get_password (pamh, flags, ctrl, &pass);
 
     if (retval != PAM_SUCCESS || pass == NULL || *pass == '\0') {
         _pam_log (LOG_ERR, "unable to obtain password");
+        _pam_spec_abandon();
         return PAM_CRED_INSUFFICIENT;
     }
 
     retval = pam_set_item (pamh, PAM_AUTHTOK, pass);
     if (retval != PAM_SUCCESS) {
         _pam_log (LOG_ERR, "unable to set password");
+        _pam_spec_abandon();
         return PAM_CRED_INSUFFICIENT;
     }
 
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: password obtained", __FUNCTION__);
 
+    /* the time the user took to type does not count */
+    tac_deadline_start();
+
     tty = _pam_get_terminal(pamh);
     if (!strncmp (tty, "/dev/", 5))
         tty += 5;
@@ -339,14 +712,35 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: rhost [%s] obtained", __FUNCTION__, r_addr);
 
+    active_broker = 0;
+    if (tac_broker != NULL
+        && (status = _pam_broker_authen(ctrl, user, pass, tty, r_addr)) >= 0) {
+        /* answered by tacplusd, skip the servers */
+        srv_i = tac_srv_no;
+    } else {
+        status = PAM_AUTH_ERR;
+        srv_i = 0;
+    }
+
     /* Attempt server connect */
-    for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+    for (; srv_i < tac_srv_no; srv_i++) {
         status = TAC_PLUS_AUTHEN_STATUS_FAIL;
         if (ctrl & PAM_TAC_DEBUG)
             _pam_log (LOG_DEBUG, "%s: trying srv %d", __FUNCTION__, srv_i );
 
-        tac_fd = tac_connect_single(tac_srv[srv_i], tac_srv_key[srv_i]);
+        if (hedge)
+            tac_fd = _pam_hedged_start(ctrl, user, pass, tty, r_addr, &srv_i,
+                &reused);
+        else
+            tac_fd = _pam_connect(ctrl, &srv_i, &reused);
         if (tac_fd < 0) {
+            /* the START could not be sent on a stale pooled connection */
+            if (reused) {
+                if (ctrl & PAM_TAC_DEBUG)
+                    _pam_log(LOG_DEBUG, "%s: pooled connection failed, reconnecting", __FUNCTION__);
+                srv_i--;
+                continue;
+            }
             _pam_log (LOG_ERR, "connection failed srv %d: %m", srv_i);
             if (srv_i == tac_srv_no-1) {
                 _pam_log (LOG_ERR, "no more servers to connect");
@@ -355,8 +749,8 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
             continue;
         }
 
-        /* Send AUTHEN/START */
-        if (tac_authen_send(tac_fd, user, pass, tty, r_addr, TAC_PLUS_AUTHEN_LOGIN, ctrl) < 0) {
+        /* Send AUTHEN/START, already done when hedging */
+        if (!hedge && tac_authen_send(tac_fd, user, pass, tty, r_addr, TAC_PLUS_AUTHEN_LOGIN, ctrl) < 0) {
             _pam_log (LOG_ERR, "error sending auth req to TACACS+ server");
             status = PAM_AUTHINFO_UNAVAIL;
         } else {
@@ -367,6 +761,10 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
 			{
             	tac_authen_read(msgstatus, tac_fd, ctrl, &seq);
         		status = msgstatus->status;
+        		/* LIBTAC_STATUS_... codes come back truncated to u_char;
+        		   a server that answered was not stale */
+        		if ((signed char) msgstatus->status >= 0)
+        			reused = 0;
 
             	switch (status) {
             		case TAC_PLUS_AUTHEN_STATUS_GETPASS:
@@ -426,7 +824,13 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
 								if (ctrl & PAM_TAC_DEBUG)
 									_pam_log (LOG_DEBUG, "%s: tac_cont_send called", __FUNCTION__);
 
-								if (tac_cont_send(tac_fd, user_data, ctrl, seq+1) < 0) {
+								/* the server may have gone away while
+								   the user was typing; do not wait for
+								   a reply that will not come */
+								if (!tac_alive(tac_fd)) {
+									_pam_log (LOG_ERR, "TACACS+ server closed the connection");
+									status = PAM_AUTHINFO_UNAVAIL;
+								} else if (tac_cont_send(tac_fd, user_data, ctrl, seq+1) < 0) {
 									_pam_log (LOG_ERR, "error sending continue req to TACACS+ server");
 									status = PAM_AUTHINFO_UNAVAIL;
 								}
@@ -454,18 +858,38 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
             if (ctrl & PAM_TAC_DEBUG)
             	_pam_log (LOG_DEBUG, "%s: out of while loop status=%d", __FUNCTION__,status);
 
+            /* the session ended cleanly, the connection can be reused */
+            if (status == TAC_PLUS_AUTHEN_STATUS_PASS
+                || status == TAC_PLUS_AUTHEN_STATUS_FAIL) {
+                tac_pool_put(tac_fd, tac_srv[srv_i], tac_srv_key[srv_i]);
+                tac_fd = -1;
+            }
+
             if (status == TAC_PLUS_AUTHEN_STATUS_PASS) {
             	/* OK, we got authenticated; save the server that
 				   accepted us for pam_sm_acct_mgmt and exit the loop */
 				status = PAM_SUCCESS;
-				active_server = tac_srv[srv_i];
-				active_key = tac_srv_key[srv_i];
+				_pam_set_active(srv_i);
             } else if (status != PAM_NEW_AUTHTOK_REQD) {
                 _pam_log (LOG_ERR, "auth failed: %d", status);
                 status = PAM_AUTH_ERR;
             }
         }
-        close(tac_fd);
+        if (tac_fd >= 0)
+            tac_close(tac_fd);
+
+        /* stop at the server that accepted us */
+        if (status == PAM_SUCCESS)
+            break;
+
+        /* the pooled connection went stale before the server said
+           anything, try once more on a new one */
+        if (reused) {
+            if (ctrl & PAM_TAC_DEBUG)
+                _pam_log(LOG_DEBUG, "%s: pooled connection failed, reconnecting", __FUNCTION__);
+            srv_i--;
+            continue;
+        }
 
         /* TODO: Allow time for tac server to reply
          * TODO: Check if reply received before connecting to next server
@@ -475,6 +899,8 @@ int pam_sm_authenticate (pam_handle_t * pamh, int flags,
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: exit with pam status: %i", __FUNCTION__, status);
 
+    _pam_spec_abandon();
+
     bzero (pass, strlen (pass));
     free(pass);
     pass = NULL;
@@ -547,11 +973,11 @@ int pam_sm_acct_mgmt (pam_handle_t * pamh, int flags,
        by TACACS+; we cannot solely authorize user if it hasn't
        been authenticated or has been authenticated by method other
        than TACACS+ */
-    if(!active_server) {
+    if(!active_server && !active_broker) {
         _pam_log (LOG_ERR, "user not authenticated by TACACS+");
         return PAM_AUTH_ERR;
     }
-    if (ctrl & PAM_TAC_DEBUG)
+    if ((ctrl & PAM_TAC_DEBUG) && active_server)
         _pam_log (LOG_DEBUG, "%s: active server is [%s]", __FUNCTION__,
             tac_ntop(active_server->ai_addr, active_server->ai_addrlen));
 
@@ -569,36 +995,86 @@ int pam_sm_acct_mgmt (pam_handle_t * pamh, int flags,
     tac_add_attrib(&attr, "service", tac_service);
     tac_add_attrib(&attr, "protocol", tac_protocol);
 
-    tac_fd = tac_connect_single(active_server, active_key);
-    if(tac_fd < 0) {
+    tac_fd = -1;
+    if (tac_broker != NULL && active_broker
+        && _pam_broker_author(ctrl, user, tty, r_addr, attr, &arep) == 0) {
+        retval = 0;
+    } else if (!active_server) {
         _pam_log (LOG_ERR, "TACACS+ server unavailable");
-        if(arep.msg != NULL) free (arep.msg);
-        close(tac_fd);
+        tac_free_attrib(&attr);
         return PAM_AUTH_ERR;
-    }
+    } else {
+        /* with author_group the first of its servers that answers,
+           otherwise the server that authenticated the user */
+        if (tac_author_group != NULL) {
+            int srv_i, reused;
+
+            _pam_group(tac_author_group);
+            _pam_balance(user);
+            for (srv_i = 0; srv_i < tac_srv_no && tac_fd < 0; srv_i++) {
+                if ((tac_fd = _pam_connect(ctrl, &srv_i, &reused)) >= 0)
+                    _pam_set_active(srv_i);
+            }
+            if (tac_fd < 0) {
+                _pam_log (LOG_ERR, "TACACS+ server unavailable");
+                tac_free_attrib(&attr);
+                return PAM_AUTH_ERR;
+            }
+        } else {
+            /* reuse the connection left open by pam_sm_authenticate */
+            tac_fd = tac_pool_get(active_server, active_key);
+        }
+        while (1) {
+            int reused = (tac_fd >= 0);
+
+            if (!reused) {
+                tac_fd = tac_connect_single(active_server, active_key);
+                if(tac_fd < 0) {
+                    _pam_log (LOG_ERR, "TACACS+ server unavailable");
+                    tac_free_attrib(&attr);
+                    return PAM_AUTH_ERR;
+                }
+            }
 
-    retval = tac_author_send(tac_fd, user, tty, r_addr, attr);
+            retval = tac_author_send(tac_fd, user, tty, r_addr, attr);
+            if(retval >= 0) {
+                if (ctrl & PAM_TAC_DEBUG)
+                    _pam_log(LOG_DEBUG, "%s: sent authorization request", __FUNCTION__);
+
+                tac_author_read(tac_fd, &arep);
+            }
+
+            /* the server may have dropped the pooled connection meanwhile,
+               try once more on a new one */
+            if (reused && (retval < 0 || arep.status < 0)) {
+                if (ctrl & PAM_TAC_DEBUG)
+                    _pam_log(LOG_DEBUG, "%s: pooled connection failed, reconnecting", __FUNCTION__);
+                if (retval >= 0 && arep.msg != NULL) free (arep.msg);
+                tac_close(tac_fd);
+                tac_fd = -1;
+                continue;
+            }
+            break;
+        }
+    }
 
     tac_free_attrib(&attr);
   
     if(retval < 0) {
         _pam_log (LOG_ERR, "error getting authorization");
-        if(arep.msg != NULL) free (arep.msg);
-        close(tac_fd);
+        tac_close(tac_fd);
         return PAM_AUTH_ERR;
     }
 
-    if (ctrl & PAM_TAC_DEBUG)
-        _pam_log(LOG_DEBUG, "%s: sent authorization request", __FUNCTION__);
-  
-    tac_author_read(tac_fd, &arep);
-
     if(arep.status != AUTHOR_STATUS_PASS_ADD &&
         arep.status != AUTHOR_STATUS_PASS_REPL) {
 
         _pam_log (LOG_ERR, "TACACS+ authorisation failed for [%s]", user);
         if(arep.msg != NULL) free (arep.msg);
-        close(tac_fd);
+        if (arep.status < 0)
+            tac_close(tac_fd);
+        else
+            tac_pool_put(tac_fd, active_server, active_key);
         return PAM_PERM_DENIED;
     }
 
@@ -645,7 +1121,7 @@ int pam_sm_acct_mgmt (pam_handle_t * pamh, int flags,
     /* free returned attributes */
     if(arep.attr != NULL) tac_free_attrib(&arep.attr);
     if(arep.msg != NULL) free (arep.msg);
-    close(tac_fd);
+    tac_pool_put(tac_fd, active_server, active_key);
 
     return status;
 }    /* pam_sm_acct_mgmt */
@@ -690,7 +1166,7 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
     char *tty;
     char *r_addr;
     int srv_i;
-    int tac_fd;
+    int tac_fd, reused;
     int status = PAM_TRY_AGAIN;
     int seq = 0;
 
@@ -708,7 +1184,7 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
     	for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
     		if (ctrl & PAM_TAC_DEBUG)
     			_pam_log (LOG_DEBUG, "%s: trying srv %d", __FUNCTION__, srv_i );
-    		tac_fd = tac_connect_single(tac_srv[srv_i], tac_srv_key[srv_i]);
+    		tac_fd = _pam_connect(ctrl, &srv_i, &reused);
 			if (tac_fd < 0) {
 				_pam_log (LOG_ERR, "connection failed srv %d: %m", srv_i);
 				if (srv_i == tac_srv_no-1) {
@@ -717,8 +1193,9 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
 				}
 				continue;
 			}
+			break;
     	}
-    	close(tac_fd);
+    	tac_close(tac_fd);
     	return PAM_SUCCESS;
     }
 
@@ -728,6 +1205,9 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: user [%s] obtained", __FUNCTION__, user);
 
+    /* server to start with, for load balancing */
+    _pam_balance(user);
+
     /* CHPASS does not send a password in data field,
      * user is prompted by a GETDATA reply packet
      */
@@ -744,13 +1224,14 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
     if (ctrl & PAM_TAC_DEBUG)
         _pam_log (LOG_DEBUG, "%s: rhost [%s] obtained", __FUNCTION__, r_addr);
 
-    /* Attempt server connect */
+    /* Attempt server connect; the broker only does logins, the password
+       change needs the conversation below and is never handed to it */
     for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
         status = TAC_PLUS_AUTHEN_STATUS_FAIL;
         if (ctrl & PAM_TAC_DEBUG)
             _pam_log (LOG_DEBUG, "%s: trying srv %d", __FUNCTION__, srv_i );
 
-        tac_fd = tac_connect_single(tac_srv[srv_i], tac_srv_key[srv_i]);
+        tac_fd = _pam_connect(ctrl, &srv_i, &reused);
         if (tac_fd < 0) {
             _pam_log (LOG_ERR, "connection failed srv %d: %m", srv_i);
             if (srv_i == tac_srv_no-1) {
@@ -772,6 +1253,9 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
 			{
 				tac_authen_read(msgstatus, tac_fd, ctrl, &seq);
 				status = msgstatus->status;
+				/* a server that answered was not stale */
+				if ((signed char) msgstatus->status >= 0)
+					reused = 0;
 
 				switch (status) {
 					case TAC_PLUS_AUTHEN_STATUS_GETPASS:
@@ -849,13 +1333,20 @@ int pam_sm_chauthtok (pam_handle_t * pamh, int flags,
                 /* OK, we got authenticated; save the server that
                    accepted us for pam_sm_acct_mgmt and exit the loop */
                 status = PAM_SUCCESS;
-                active_server = tac_srv[srv_i];
-                active_key = tac_srv_key[srv_i];
-                close(tac_fd);
+                _pam_set_active(srv_i);
+                tac_close(tac_fd);
                 break;
             }
         }
-        close(tac_fd);
+        tac_close(tac_fd);
+
+        /* the pooled connection went stale, retry on a new one */
+        if (reused) {
+            if (ctrl & PAM_TAC_DEBUG)
+                _pam_log(LOG_DEBUG, "%s: pooled connection failed, reconnecting", __FUNCTION__);
+            srv_i--;
+            continue;
+        }
     }
 
     if (ctrl & PAM_TAC_DEBUG)
@@ -26,6 +26,8 @@
 #define PAM_TAC_USE_FIRST_PASS 0x04
 #define PAM_TAC_TRY_FIRST_PASS 0x08
 #define PAM_TAC_PACKET_DEBUG 0xA
+#define PAM_TAC_PARALLEL 0x10 /* connect to all servers at once */
+#define PAM_TAC_SINGLE_CONNECT 0x20 /* ask servers to keep connection open */
 
 /* pam_tacplus major, minor and patchlevel version numbers */
 #define PAM_TAC_VMAJ 1
@@ -32,18 +32,40 @@
 
 #include "pam_tacplus.h"
 #include "libtac.h"
+#include "broker.h"
 
-struct addrinfo *tac_srv[TAC_PLUS_MAXSERVERS];
+/* servers of the group in use, see _pam_group() */
+struct addrinfo **tac_srv = NULL;
 int tac_srv_no = 0;
-char *tac_srv_key[TAC_PLUS_MAXSERVERS];
-int tac_srv_key_no = 0;
+char **tac_srv_key = NULL;
+char *tac_authen_group = NULL;
+char *tac_author_group = NULL;
+char *tac_acct_group = NULL;
 char *tac_service = NULL;
 char *tac_protocol = NULL;
 char *tac_prompt = NULL;
+char *tac_broker = NULL;
+int tac_hedge_delay = 0;
 
 /* libtac */
 extern char *tac_login;
 extern int tac_timeout;
+extern int tac_connect_delay;
+extern int tac_fastopen;
+extern int tac_tls;
+extern char *tac_tls_ca;
+extern char *tac_tls_cert;
+extern char *tac_tls_key;
+extern int tac_keepalive;
+extern int tac_user_timeout;
+extern int tac_deadline_ms;
+extern int tac_dns_ttl;
+extern int tac_single_connect;
+extern int tac_pool_idle;
+extern char *tac_health_file;
+extern int tac_health_holddown;
+extern int tac_retry_budget;
+extern int tac_balance;
 
 /*
     FIXME using xcalloc() leaks memory for long-running programs that authenticate multiple times
@@ -194,11 +216,48 @@ int tacacs_get_password (pam_handle_t * pamh, int flags
     return PAM_SUCCESS;
 }
 
+/* Makes the servers of group the ones in use, fastest healthy server
+ * first; all servers if group is NULL or has no servers.
+ */
+void _pam_group(const char *group) {
+    tac_srv_no = tac_srvtab_group(group, &tac_srv, &tac_srv_key);
+    tac_health_order(tac_srv, tac_srv_key, tac_srv_no);
+}
+
+/* Moves the server the balance= policy picks for user to the front of
+ * the servers in use.
+ */
+void _pam_balance(const char *user) {
+    tac_health_balance(tac_srv, tac_srv_key, tac_srv_no, user);
+}
+
 int _pam_parse (int argc, const char **argv) {
     int ctrl = 0;
+    const char *crypto = NULL;
 
     /* otherwise the list will grow with each call */
-    tac_srv_no = tac_srv_key_no = 0;
+    tac_srvtab_reset();
+    tac_hedge_delay = 0;
+    tac_deadline_ms = 0;
+    tac_connect_delay = TAC_PLUS_CONNECT_DELAY;
+    tac_pool_idle = TAC_PLUS_POOL_IDLE;
+    tac_health_holddown = TAC_PLUS_HOLDDOWN;
+    tac_retry_budget = TAC_PLUS_RETRY_BUDGET;
+    tac_dns_ttl = TAC_PLUS_DNS_TTL;
+    tac_keepalive = 0;
+    tac_user_timeout = 0;
+    tac_fastopen = 0;
+    tac_tls = 0;
+    tac_tls_ca = tac_tls_cert = tac_tls_key = NULL;
+    tac_balance = TAC_BALANCE_ORDER;
+    free(tac_authen_group);
+    free(tac_author_group);
+    free(tac_acct_group);
+    tac_authen_group = tac_author_group = tac_acct_group = NULL;
+    free(tac_broker);
+    tac_broker = NULL;
+    free(tac_health_file);
+    tac_health_file = NULL;
 
     for (ctrl = 0; argc-- > 0; ++argv) {
         if (!strcmp (*argv, "debug")) { /* all */
@@ -227,52 +286,83 @@ int _pam_parse (int argc, const char **argv) {
             }
         } else if (!strcmp (*argv, "acct_all")) {
             ctrl |= PAM_TAC_ACCT;
+        } else if (!strcmp (*argv, "parallel_connect")) {
+            ctrl |= PAM_TAC_PARALLEL;
+        } else if (!strcmp (*argv, "single_connect")) {
+            ctrl |= PAM_TAC_SINGLE_CONNECT;
+        } else if (!strcmp (*argv, "tfo")) {
+            tac_fastopen = 1;
+        } else if (!strncmp (*argv, "crypto=", 7)) {
+            crypto = *argv + 7;
+        } else if (!strcmp (*argv, "tls")) {
+            tac_tls = 1;
+        } else if (!strncmp (*argv, "tls_ca=", 7)) {
+            tac_tls_ca = (char *) *argv + 7;
+        } else if (!strncmp (*argv, "tls_cert=", 9)) {
+            tac_tls_cert = (char *) *argv + 9;
+        } else if (!strncmp (*argv, "tls_key=", 8)) {
+            tac_tls_key = (char *) *argv + 8;
         } else if (!strncmp (*argv, "server=", 7)) { /* authen & acct */
-            if(tac_srv_no < TAC_PLUS_MAXSERVERS) { 
-                struct addrinfo hints, *servers, *server;
-                int rv;
-                char *port, server_buf[256];
-
-                memset(&hints, 0, sizeof hints);
-                hints.ai_family = AF_UNSPEC;  /* use IPv4 or IPv6, whichever */
-                hints.ai_socktype = SOCK_STREAM;
-
-                if (strlen(*argv + 7) >= sizeof(server_buf)) {
-                    _pam_log(LOG_ERR, "server address too long, sorry");
-                    continue;
-                }
-                strcpy(server_buf, *argv + 7);
-
-                port = strchr(server_buf, ':');
-                if (port != NULL) {
-                    *port = '\0';
-					port++;
-                }
-                if ((rv = getaddrinfo(server_buf, (port == NULL) ? "49" : port, &hints, &servers)) == 0) {
-                    for(server = servers; server != NULL && tac_srv_no < TAC_PLUS_MAXSERVERS; server = server->ai_next) {
-                        tac_srv[tac_srv_no] = server;
-                        tac_srv_no++;
-                    }
-                } else {
-                    _pam_log (LOG_ERR,
-                        "skip invalid server: %s (getaddrinfo: %s)",
-                        server_buf, gai_strerror(rv));
-                }
-            } else {
-                _pam_log(LOG_ERR, "maximum number of servers (%d) exceeded, skipping",
-                    TAC_PLUS_MAXSERVERS);
-            }
+            if (tac_srvtab_add(*argv + 7) < 0)
+                _pam_log(LOG_ERR, "skip invalid server: %s", *argv + 7);
         } else if (!strncmp (*argv, "secret=", 7)) {
-            if(tac_srv_key_no < TAC_PLUS_MAXSERVERS) {
-                tac_srv_key[tac_srv_key_no] = (char *) _xcalloc (strlen (*argv + 7) + 1);
-                strcpy (tac_srv_key[tac_srv_key_no], *argv + 7);
-                tac_srv_key_no++;
-            } else {
-                _pam_log(LOG_ERR, "maximum number of secrets (%d) exceeded, skipping",
-                    TAC_PLUS_MAXSERVERS);
-            }
+            tac_srvtab_key(*argv + 7);
+        } else if (!strncmp (*argv, "authen_group=", 13)) {
+            tac_authen_group = (char *) _xcalloc (strlen (*argv + 13) + 1);
+            strcpy (tac_authen_group, *argv + 13);
+        } else if (!strncmp (*argv, "author_group=", 13)) {
+            tac_author_group = (char *) _xcalloc (strlen (*argv + 13) + 1);
+            strcpy (tac_author_group, *argv + 13);
+        } else if (!strncmp (*argv, "acct_group=", 11)) {
+            tac_acct_group = (char *) _xcalloc (strlen (*argv + 11) + 1);
+            strcpy (tac_acct_group, *argv + 11);
+        } else if (!strncmp (*argv, "dns_ttl=", 8)) {
+            tac_dns_ttl = atoi(*argv + 8);
         } else if (!strncmp (*argv, "timeout=", 8)) {
             tac_timeout = atoi(*argv + 8);
+        } else if (!strncmp (*argv, "keepalive=", 10)) {
+            tac_keepalive = atoi(*argv + 10);
+        } else if (!strncmp (*argv, "user_timeout=", 13)) {
+            tac_user_timeout = atoi(*argv + 13);
+        } else if (!strncmp (*argv, "deadline_ms=", 12)) {
+            tac_deadline_ms = atoi(*argv + 12);
+        } else if (!strncmp (*argv, "connect_delay=", 14)) {
+            tac_connect_delay = atoi(*argv + 14);
+        } else if (!strncmp (*argv, "pool_idle=", 10)) {
+            tac_pool_idle = atoi(*argv + 10);
+        } else if (!strcmp (*argv, "health")) {
+            free(tac_health_file);
+            tac_health_file =
+                (char *) _xcalloc (strlen (TAC_PLUS_HEALTH_FILE) + 1);
+            strcpy (tac_health_file, TAC_PLUS_HEALTH_FILE);
+        } else if (!strncmp (*argv, "health=", 7)) {
+            free(tac_health_file);
+            tac_health_file = (char *) _xcalloc (strlen (*argv + 7) + 1);
+            strcpy (tac_health_file, *argv + 7);
+        } else if (!strncmp (*argv, "holddown=", 9)) {
+            tac_health_holddown = atoi(*argv + 9);
+        } else if (!strcmp (*argv, "hedge=auto")) {
+            tac_hedge_delay = -1;
+        } else if (!strncmp (*argv, "hedge=", 6)) {
+            tac_hedge_delay = atoi(*argv + 6);
+        } else if (!strcmp (*argv, "balance=order")) {
+            tac_balance = TAC_BALANCE_ORDER;
+        } else if (!strcmp (*argv, "balance=wrr")) {
+            tac_balance = TAC_BALANCE_WRR;
+        } else if (!strcmp (*argv, "balance=p2c")) {
+            tac_balance = TAC_BALANCE_P2C;
+        } else if (!strcmp (*argv, "balance=user")) {
+            tac_balance = TAC_BALANCE_USER;
+        } else if (!strncmp (*argv, "retry_budget=", 13)) {
+            tac_retry_budget = atoi(*argv + 13);
+        } else if (!strcmp (*argv, "broker")) {
+            free(tac_broker);
+            tac_broker = (char *) _xcalloc (strlen (TACD_SOCKET) + 1);
+            strcpy (tac_broker, TACD_SOCKET);
+        } else if (!strncmp (*argv, "broker=", 7)) {
+            free(tac_broker);
+            tac_broker = (char *) _xcalloc (strlen (*argv + 7) + 1);
+            strcpy (tac_broker, *argv + 7);
         } else if (!strncmp (*argv, "login=", 6)) {
             tac_login = (char *) _xcalloc (strlen (*argv + 6) + 1);
             strcpy (tac_login, *argv + 6);
@@ -281,16 +371,21 @@ int _pam_parse (int argc, const char **argv) {
         }
     }
 
-    if (tac_srv_key_no == 0) {
-        /* FIXME this should really be NULL
-           but watch out with breaking other code
-        */
-        tac_srv_key[0] = "";
-        tac_srv_key_no++;
-    }
-    for (;tac_srv_key_no < tac_srv_no;tac_srv_key_no++) {
-        tac_srv_key[tac_srv_key_no] = tac_srv_key[0];
-    }
+    tac_single_connect = (ctrl & PAM_TAC_SINGLE_CONNECT) ? 1 : 0;
+
+    tac_crypto_select(crypto);
+    if (ctrl & PAM_TAC_DEBUG)
+        _pam_log(LOG_DEBUG, "%s: MD5 provider %s%s", __FUNCTION__,
+            tac_crypto_name(), crypto != NULL ? " (pinned)" : "");
+
+    /* all server names at once, from the cache if it is fresh */
+    tac_srvtab_build();
+
+    /* authentication servers unless the caller picks another group */
+    _pam_group(tac_authen_group);
+
+    /* the module call starts its deadline budget here */
+    tac_deadline_start();
 
     return ctrl;
 }    /* _pam_parse */
@@ -26,6 +26,8 @@
 
 /* support.c */
 extern int _pam_parse (int argc, const char **argv);
+extern void _pam_group (const char *group);
+extern void _pam_balance (const char *user);
 extern unsigned long _resolve_name (char *serv);
 extern int tacacs_get_password (pam_handle_t * pamh, int flags
     ,int ctrl, char **password);
@@ -0,0 +1,571 @@
+/* tacplusd.c - TACACS+ broker for pam_tacplus.
+ *
+ * Keeps connections to the TACACS+ servers open across logins and
+ * serves authentication, authorization and accounting requests of
+ * pam_tacplus (option broker=) arriving over an AF_UNIX socket, so
+ * that a login costs one local round trip instead of a TCP connect and
+ * a failover loop in every sshd or sudo process.
+ *
+ * Requests are served by a fixed number of worker processes, each
+ * taking one client at a time off the shared listening socket and
+ * keeping its own connections to the servers; libtac state such as the
+ * current secret and session_id is per process. With single_connect
+ * servers a request normally needs no more than one round trip to the
+ * server over an already open connection. A client gets client_timeout
+ * milliseconds to send its request, so a stalled one holds a worker
+ * for no longer than that.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "libtac.h"
+#include "pam_tacplus.h"
+#include "broker.h"
+
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+/* servers of the group serving the request, see tacd_serve() */
+static struct addrinfo **tac_srv = NULL;
+static char **tac_srv_key = NULL;
+static int tac_srv_no = 0;
+static char *authen_group = NULL;
+static char *author_group = NULL;
+static char *acct_group = NULL;
+static int ctrl = 0;
+static char *socket_path = TACD_SOCKET;
+static int foreground = 0;
+static int workers = 4;
+static int client_timeout = 2000;    /* ms to read a request in */
+
+static volatile sig_atomic_t terminate = 0;
+
+static void usage(void) {
+    fprintf(stderr, "usage: tacplusd server=HOST[:PORT] [secret=STRING]"
+        " [timeout=SEC] [deadline_ms=MS]\n"
+        "                [keepalive=SEC] [user_timeout=MS]\n"
+        "                [parallel_connect] [connect_delay=MS]"
+        " [pool_idle=SEC] [tfo]\n"
+        "                [crypto=auto|builtin|libcrypto]\n"
+        "                [tls] [tls_ca=PATH] [tls_cert=PATH] [tls_key=PATH]\n"
+        "                [health[=PATH]] [holddown=SEC]"
+        " [balance=order|wrr|p2c|user]\n"
+        "                [authen_group=NAME] [author_group=NAME]"
+        " [acct_group=NAME]\n"
+        "                [login=STRING] [socket=PATH] [workers=N]"
+        " [client_timeout=MS]\n"
+        "                [foreground] [debug]\n");
+    exit(1);
+}
+
+/* Takes the same options as the PAM module, as far as they make sense
+ * for the broker, plus socket=, workers=, client_timeout= and
+ * foreground.
+ */
+static void parse_args(int argc, char **argv) {
+    for (; argc-- > 0; ++argv) {
+        if (!strcmp(*argv, "debug")) {
+            ctrl |= PAM_TAC_DEBUG;
+        } else if (!strcmp(*argv, "packet_debug")) {
+            ctrl |= PAM_TAC_PACKET_DEBUG;
+        } else if (!strcmp(*argv, "foreground")) {
+            foreground = 1;
+        } else if (!strcmp(*argv, "parallel_connect")) {
+            ctrl |= PAM_TAC_PARALLEL;
+        } else if (!strcmp(*argv, "single_connect")) {
+            /* always on, accepted for symmetry with the PAM module */
+        } else if (!strcmp(*argv, "tfo")) {
+            tac_fastopen = 1;
+        } else if (!strncmp(*argv, "crypto=", 7)) {
+            tac_crypto_select(*argv + 7);
+        } else if (!strcmp(*argv, "tls")) {
+            tac_tls = 1;
+        } else if (!strncmp(*argv, "tls_ca=", 7)) {
+            tac_tls_ca = *argv + 7;
+        } else if (!strncmp(*argv, "tls_cert=", 9)) {
+            tac_tls_cert = *argv + 9;
+        } else if (!strncmp(*argv, "tls_key=", 8)) {
+            tac_tls_key = *argv + 8;
+        } else if (!strncmp(*argv, "socket=", 7)) {
+            socket_path = *argv + 7;
+        } else if (!strncmp(*argv, "workers=", 8)) {
+            workers = atoi(*argv + 8);
+        } else if (!strncmp(*argv, "client_timeout=", 15)) {
+            client_timeout = atoi(*argv + 15);
+        } else if (!strncmp(*argv, "server=", 7)) {
+            if (tac_srvtab_add(*argv + 7) < 0)
+                syslog(LOG_ERR, "skip invalid server: %s", *argv + 7);
+        } else if (!strncmp(*argv, "secret=", 7)) {
+            tac_srvtab_key(*argv + 7);
+        } else if (!strncmp(*argv, "authen_group=", 13)) {
+            authen_group = *argv + 13;
+        } else if (!strncmp(*argv, "author_group=", 13)) {
+            author_group = *argv + 13;
+        } else if (!strncmp(*argv, "acct_group=", 11)) {
+            acct_group = *argv + 11;
+        } else if (!strncmp(*argv, "timeout=", 8)) {
+            tac_timeout = atoi(*argv + 8);
+        } else if (!strncmp(*argv, "keepalive=", 10)) {
+            tac_keepalive = atoi(*argv + 10);
+        } else if (!strncmp(*argv, "user_timeout=", 13)) {
+            tac_user_timeout = atoi(*argv + 13);
+        } else if (!strncmp(*argv, "deadline_ms=", 12)) {
+            tac_deadline_ms = atoi(*argv + 12);
+        } else if (!strncmp(*argv, "connect_delay=", 14)) {
+            tac_connect_delay = atoi(*argv + 14);
+        } else if (!strncmp(*argv, "pool_idle=", 10)) {
+            tac_pool_idle = atoi(*argv + 10);
+        } else if (!strcmp(*argv, "health")) {
+            tac_health_file = TAC_PLUS_HEALTH_FILE;
+        } else if (!strncmp(*argv, "health=", 7)) {
+            tac_health_file = *argv + 7;
+        } else if (!strncmp(*argv, "holddown=", 9)) {
+            tac_health_holddown = atoi(*argv + 9);
+        } else if (!strcmp(*argv, "balance=order")) {
+            tac_balance = TAC_BALANCE_ORDER;
+        } else if (!strcmp(*argv, "balance=wrr")) {
+            tac_balance = TAC_BALANCE_WRR;
+        } else if (!strcmp(*argv, "balance=p2c")) {
+            tac_balance = TAC_BALANCE_P2C;
+        } else if (!strcmp(*argv, "balance=user")) {
+            tac_balance = TAC_BALANCE_USER;
+        } else if (!strncmp(*argv, "login=", 6)) {
+            tac_login = *argv + 6;
+        } else {
+            fprintf(stderr, "tacplusd: unrecognized option: %s\n", *argv);
+            usage();
+        }
+    }
+
+    /* resolved once, the broker runs for long but servers rarely move */
+    tac_srvtab_build();
+    if (tac_server_no == 0 || workers < 1 || client_timeout < 1)
+        usage();
+
+    /* warm connections are the point of running the broker */
+    tac_single_connect = 1;
+}    /* parse_args */
+
+/* Returns a connection to the first available server starting at
+ * tac_srv[*srv_i], see _pam_connect() in pam_tacplus.c. *reused is set
+ * when the connection came out of the pool and may turn out stale.
+ */
+static int _tacd_connect(int *srv_i, int *reused) {
+    int fd, i, winner = 0;
+
+    for (i = *srv_i; i < tac_srv_no; i++) {
+        if ((fd = tac_pool_get(tac_srv[i], tac_srv_key[i])) >= 0) {
+            *srv_i = i;
+            *reused = 1;
+            return fd;
+        }
+        if (!(ctrl & PAM_TAC_PARALLEL))
+            break;
+    }
+    *reused = 0;
+
+    if (!(ctrl & PAM_TAC_PARALLEL) || tac_srv_no - *srv_i < 2)
+        return tac_connect_single(tac_srv[*srv_i], tac_srv_key[*srv_i]);
+
+    fd = tac_connect_parallel(&tac_srv[*srv_i], &tac_srv_key[*srv_i],
+        tac_srv_no - *srv_i, &winner);
+    if (fd < 0)
+        *srv_i = tac_srv_no - 1;
+    else
+        *srv_i += winner;
+    return fd;
+}
+
+/* Runs an ASCII login for argv user, pass, tty, r_addr, trying the
+ * servers in order until one lets the user in. A GETDATA request (e.g.
+ * password change) needs a conversation with the user and is handed
+ * back to the PAM module.
+ */
+static void tacd_authen(struct tacd_msg *req, struct tacd_msg *rep) {
+    char *user = req->argv[0], *pass = req->argv[1];
+    char *tty = req->argv[2], *r_addr = req->argv[3];
+    char *server_msg = NULL;
+    int srv_i, fd, reused, seq = 0;
+    int status = LIBTAC_STATUS_CONN_ERR;
+    msg_status ms;
+
+    for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+        if ((fd = _tacd_connect(&srv_i, &reused)) < 0)
+            continue;
+
+        status = LIBTAC_STATUS_WRITE_ERR;
+        if (tac_authen_send(fd, user, pass, tty, r_addr,
+            TAC_PLUS_AUTHEN_LOGIN, ctrl) >= 0) {
+            do {
+                ms.server_msg = NULL;
+                tac_authen_read(&ms, fd, ctrl, &seq);
+                /* LIBTAC_STATUS_... codes come back truncated to u_char */
+                status = (signed char) ms.status;
+                free(server_msg);
+                server_msg = ms.server_msg;
+
+                if (status == TAC_PLUS_AUTHEN_STATUS_GETPASS) {
+                    if (tac_cont_send(fd, pass, ctrl, seq+1) < 0)
+                        status = LIBTAC_STATUS_WRITE_ERR;
+                } else if (status == TAC_PLUS_AUTHEN_STATUS_GETUSER) {
+                    if (tac_cont_send(fd, user, ctrl, seq+1) < 0)
+                        status = LIBTAC_STATUS_WRITE_ERR;
+                }
+            } while (status == TAC_PLUS_AUTHEN_STATUS_GETPASS
+                || status == TAC_PLUS_AUTHEN_STATUS_GETUSER);
+        }
+
+        if (status == TAC_PLUS_AUTHEN_STATUS_PASS
+            || status == TAC_PLUS_AUTHEN_STATUS_FAIL) {
+            tac_pool_put(fd, tac_srv[srv_i], tac_srv_key[srv_i]);
+        } else {
+            tac_close(fd);
+            /* the pooled connection went stale, retry on a new one */
+            if (reused && status != TAC_PLUS_AUTHEN_STATUS_GETDATA) {
+                srv_i--;
+                continue;
+            }
+        }
+
+        if (status == TAC_PLUS_AUTHEN_STATUS_PASS
+            || status == TAC_PLUS_AUTHEN_STATUS_GETDATA)
+            break;
+    }
+
+    rep->arg = status;
+    tacd_add_arg(rep, server_msg);
+    free(server_msg);
+    if (srv_i < tac_srv_no) {
+        char *addr = tac_ntop(tac_srv[srv_i]->ai_addr,
+            tac_srv[srv_i]->ai_addrlen);
+
+        tacd_add_arg(rep, addr);
+        free(addr);
+    } else {
+        tacd_add_arg(rep, NULL);
+    }
+}    /* tacd_authen */
+
+/* Authorizes argv user, tty, r_addr, attributes... on the first
+ * available server.
+ */
+static void tacd_author(struct tacd_msg *req, struct tacd_msg *rep) {
+    struct tac_attrib *attr = NULL;
+    struct areply arep;
+    int srv_i, fd, reused;
+
+    tacd_args_attrib(req, 3, &attr);
+    bzero(&arep, sizeof(arep));
+    arep.status = LIBTAC_STATUS_CONN_ERR;
+
+    for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+        if ((fd = _tacd_connect(&srv_i, &reused)) < 0)
+            continue;
+
+        if (tac_author_send(fd, req->argv[0], req->argv[2], req->argv[3],
+            attr) < 0)
+            arep.status = LIBTAC_STATUS_WRITE_ERR;
+        else
+            tac_author_read(fd, &arep);
+
+        if (arep.status >= 0) {
+            tac_pool_put(fd, tac_srv[srv_i], tac_srv_key[srv_i]);
+            break;
+        }
+        tac_close(fd);
+        if (reused)
+            srv_i--;
+    }
+    tac_free_attrib(&attr);
+
+    rep->arg = arep.status;
+    tacd_add_arg(rep, arep.msg);
+    tacd_add_attrib_args(rep, arep.attr);
+    if (arep.msg != NULL)
+        free(arep.msg);
+    if (arep.attr != NULL)
+        tac_free_attrib(&arep.attr);
+}    /* tacd_author */
+
+/* Sends accounting for argv user, tty, r_addr, attributes... to the
+ * first available server or, with TACD_ACCT_ALL, to all of them.
+ */
+static void tacd_acct(struct tacd_msg *req, struct tacd_msg *rep) {
+    struct tac_attrib *attr = NULL;
+    struct areply arep;
+    int type = req->arg & ~TACD_ACCT_ALL;
+    int srv_i, fd, reused, status;
+
+    tacd_args_attrib(req, 3, &attr);
+    rep->arg = LIBTAC_STATUS_CONN_ERR;
+
+    if ((req->arg & TACD_ACCT_ALL) && tac_srv_no > 0) {
+        int *srv_status = (int *) xcalloc(tac_srv_no, sizeof(int));
+
+        /* to all servers at once, success if any of them took it */
+        if (tac_acct_all(type, req->argv[0], req->argv[2], req->argv[3],
+            attr, tac_srv, tac_srv_key, tac_srv_no, srv_status) > 0) {
+            rep->arg = TAC_PLUS_ACCT_STATUS_SUCCESS;
+        } else {
+            for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+                if (srv_status[srv_i] >= 0
+                    || rep->arg == LIBTAC_STATUS_CONN_ERR)
+                    rep->arg = srv_status[srv_i];
+            }
+        }
+        for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+            char *addr;
+
+            if (srv_status[srv_i] == TAC_PLUS_ACCT_STATUS_SUCCESS)
+                continue;
+            addr = tac_ntop(tac_srv[srv_i]->ai_addr, 0);
+            syslog(LOG_WARNING, "%s: accounting to %s failed: %d",
+                __FUNCTION__, addr, srv_status[srv_i]);
+            free(addr);
+        }
+        free(srv_status);
+        tac_free_attrib(&attr);
+        tacd_add_arg(rep, NULL);
+        return;
+    }
+
+    for (srv_i = 0; srv_i < tac_srv_no; srv_i++) {
+        if ((fd = _tacd_connect(&srv_i, &reused)) < 0)
+            continue;
+
+        bzero(&arep, sizeof(arep));
+        if (tac_acct_send(fd, type, req->argv[0], req->argv[2],
+            req->argv[3], attr) < 0)
+            status = LIBTAC_STATUS_WRITE_ERR;
+        else
+            status = tac_acct_read(fd, &arep);
+        if (arep.msg != NULL)
+            free(arep.msg);
+
+        if (status < 0) {
+            tac_close(fd);
+            if (reused)
+                srv_i--;
+            continue;
+        }
+        tac_pool_put(fd, tac_srv[srv_i], tac_srv_key[srv_i]);
+
+        /* report success if any of the servers took it */
+        if (rep->arg != TAC_PLUS_ACCT_STATUS_SUCCESS)
+            rep->arg = status;
+        if (status == TAC_PLUS_ACCT_STATUS_SUCCESS
+            && !(req->arg & TACD_ACCT_ALL))
+            break;
+    }
+    tac_free_attrib(&attr);
+    tacd_add_arg(rep, NULL);
+}    /* tacd_acct */
+
+static void tacd_serve(int fd) {
+    struct tacd_msg req, rep;
+
+    if (tacd_read_msg(fd, &req, client_timeout) < 0)
+        return;
+
+    bzero(&rep, sizeof(rep));
+    rep.op = req.op;
+    rep.arg = LIBTAC_STATUS_ASSEMBLY_ERR;
+
+    /* servers of the group for the request, fastest healthy one first */
+    tac_srv_no = tac_srvtab_group(req.op == TACD_OP_AUTHOR ? author_group
+        : req.op == TACD_OP_ACCT ? acct_group : authen_group,
+        &tac_srv, &tac_srv_key);
+    tac_health_order(tac_srv, tac_srv_key, tac_srv_no);
+    tac_health_balance(tac_srv, tac_srv_key, tac_srv_no,
+        req.argc > 0 ? req.argv[0] : NULL);
+    tac_deadline_start();
+
+    switch (req.op) {
+        case TACD_OP_AUTHEN:
+            if (req.argc == 4)
+                tacd_authen(&req, &rep);
+            break;
+        case TACD_OP_AUTHOR:
+            if (req.argc >= 3)
+                tacd_author(&req, &rep);
+            break;
+        case TACD_OP_ACCT:
+            if (req.argc >= 3)
+                tacd_acct(&req, &rep);
+            break;
+        default:
+            syslog(LOG_ERR, "%s: unknown request %d", __FUNCTION__, req.op);
+            break;
+    }
+
+    if (ctrl & PAM_TAC_DEBUG)
+        syslog(LOG_DEBUG, "%s: request %d for [%s] status %d", __FUNCTION__,
+            req.op, req.argc > 0 ? req.argv[0] : "", rep.arg);
+
+    tacd_write_msg(fd, &rep);
+    tacd_free_msg(&rep);
+    tacd_free_msg(&req);
+}
+
+static void on_signal(int sig) {
+    (void) sig;
+    terminate = 1;
+}
+
+/* Serves clients off the non blocking listening socket lfd until told
+ * to terminate; whichever idle worker accepts first gets the client.
+ */
+static void tacd_worker(int lfd) {
+    struct pollfd pfd;
+    int fd;
+
+    pfd.fd = lfd;
+    pfd.events = POLLIN;
+    while (!terminate) {
+        /* wake up now and then to let idle connections go */
+        if (poll(&pfd, 1, 1000) <= 0) {
+            tac_pool_reap();
+            continue;
+        }
+
+        if ((fd = accept(lfd, NULL, NULL)) < 0) {
+            /* EAGAIN: another worker was quicker */
+            if (errno != EINTR && errno != ECONNABORTED
+                && errno != EAGAIN && errno != EWOULDBLOCK)
+                syslog(LOG_ERR, "accept: %m");
+            continue;
+        }
+        tacd_serve(fd);
+        close(fd);
+    }
+}
+
+/* Starts a worker on lfd.
+ *
+ * return value:
+ *   >  0 : pid of the worker
+ *   <= 0 : fork() failed
+ */
+static pid_t tacd_spawn(int lfd) {
+    pid_t pid;
+
+    if ((pid = fork()) == 0) {
+        tacd_worker(lfd);
+        exit(0);
+    }
+    if (pid < 0)
+        syslog(LOG_ERR, "fork: %m");
+    return pid;
+}
+
+int main(int argc, char **argv) {
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    pid_t *pid, dead;
+    mode_t mask;
+    int lfd, i;
+
+    parse_args(argc - 1, argv + 1);
+
+    openlog("tacplusd", LOG_PID | (foreground ? LOG_PERROR : 0), LOG_AUTH);
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        syslog(LOG_ERR, "socket path too long: %s", socket_path);
+        return 1;
+    }
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    if ((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+        || fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        syslog(LOG_ERR, "socket: %m");
+        return 1;
+    }
+    unlink(socket_path);
+
+    /* passwords go through the socket, keep it to the owner */
+    mask = umask(077);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(lfd, SOMAXCONN) < 0) {
+        syslog(LOG_ERR, "%s: %m", socket_path);
+        return 1;
+    }
+    umask(mask);
+
+    if (!foreground && daemon(0, 0) < 0) {
+        syslog(LOG_ERR, "daemon: %m");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    /* no SA_RESTART, wait() below has to return on these */
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    syslog(LOG_INFO, "listening on %s, %d server(s), %d worker(s)",
+        socket_path, tac_server_no, workers);
+    if (ctrl & PAM_TAC_DEBUG)
+        syslog(LOG_DEBUG, "MD5 provider %s", tac_crypto_name());
+
+    /* keep the workers running, replacing any that dies */
+    pid = (pid_t *) xcalloc(workers, sizeof(pid_t));
+    while (!terminate) {
+        for (i = 0; i < workers; i++) {
+            if (pid[i] <= 0)
+                pid[i] = tacd_spawn(lfd);
+        }
+
+        if ((dead = wait(NULL)) < 0) {
+            /* ECHILD: no worker could be started, try again later */
+            if (errno == ECHILD)
+                sleep(1);
+            continue;
+        }
+        for (i = 0; i < workers; i++) {
+            if (pid[i] == dead) {
+                syslog(LOG_WARNING, "worker %d exited", (int) dead);
+                pid[i] = 0;
+            }
+        }
+        /* don't spin on a worker that dies right away */
+        sleep(1);
+    }
+
+    for (i = 0; i < workers; i++) {
+        if (pid[i] > 0)
+            kill(pid[i], SIGTERM);
+    }
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+    free(pid);
+
+    unlink(socket_path);
+    syslog(LOG_INFO, "terminating");
+    return 0;
+}
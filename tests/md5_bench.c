@@ -0,0 +1,86 @@
+/* md5_bench.c - MD5Update() against the byte at a time md5_ref.c.
+ *
+ * Run with `make bench'. Prints the time per digest and the throughput
+ * of both implementations for a pad step sized message and for bulk
+ * input.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "md5.h"
+#include "md5_ref.h"
+
+/* session_id, a 16 byte key, version, seq_no and the previous digest */
+#define PAD_STEP (4 + 16 + 1 + 1 + MD5_LEN)
+
+static const unsigned int sizes[] = { PAD_STEP, 1024, 65536 };
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Digests len bytes of msg rounds times with init/update/final.
+ *
+ * return value:
+ *   seconds taken
+ */
+static double run(void (*init)(MD5_CTX *),
+    void (*update)(MD5_CTX *, unsigned char *, UINT4),
+    void (*final)(unsigned char *, MD5_CTX *),
+    unsigned char *msg, unsigned int len, long rounds) {
+
+    MD5_CTX ctx;
+    double t = now();
+    long r;
+
+    for (r = 0; r < rounds; r++) {
+        init(&ctx);
+        update(&ctx, msg, len);
+        final(msg, &ctx);    /* feeds the next round, like the pad */
+    }
+    return now() - t;
+}
+
+int main(void) {
+    unsigned char *msg = (unsigned char *) calloc(1, 65536);
+    unsigned int i;
+    double ref, cur;
+    long rounds;
+
+    printf("%8s %12s %12s %10s %10s %7s\n", "bytes", "ref ns/op",
+        "new ns/op", "ref MB/s", "new MB/s", "speedup");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        /* about 64 MB through each implementation */
+        rounds = (64L << 20) / sizes[i];
+        ref = run(MD5RefInit, MD5RefUpdate, MD5RefFinal, msg, sizes[i],
+            rounds);
+        cur = run(MD5Init, MD5Update, MD5Final, msg, sizes[i], rounds);
+        printf("%8u %12.1f %12.1f %10.1f %10.1f %6.2fx\n", sizes[i],
+            ref * 1e9 / rounds, cur * 1e9 / rounds,
+            rounds * (double) sizes[i] / ref / 1e6,
+            rounds * (double) sizes[i] / cur / 1e6, ref / cur);
+    }
+    free(msg);
+    return 0;
+}
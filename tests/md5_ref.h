@@ -0,0 +1,30 @@
+/* md5_ref.h - the MD5 routines of md5_ref.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#ifndef _MD5_REF_H
+#define _MD5_REF_H
+
+#include "md5.h"
+
+__BEGIN_DECLS
+void MD5RefInit __P((MD5_CTX*));
+void MD5RefUpdate __P((MD5_CTX*, unsigned char*, UINT4));
+void MD5RefFinal __P((unsigned char[], MD5_CTX*));
+__END_DECLS
+
+#endif
@@ -0,0 +1,118 @@
+/* md5_test.c - known answers for MD5Init/Update/Final.
+ *
+ * The RFC 1321 test suite plus messages around the 64 byte block
+ * boundary, each fed to MD5Update() in one go and in pieces, so that
+ * both the buffered bytes and the whole-block path are taken.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+
+/* RFC 1321, appendix A.5 */
+static const struct {
+    const char *msg;
+    const char *digest;
+} rfc1321[] = {
+    { "", "d41d8cd98f00b204e9800998ecf8427e" },
+    { "a", "0cc175b9c0f1b6a831c399e269772661" },
+    { "abc", "900150983cd24fb0d6963f7d28e17f72" },
+    { "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+    { "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+    { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+      "d174ab98d277d9f5a5611c2c9f419d9f" },
+    { "1234567890123456789012345678901234567890"
+      "1234567890123456789012345678901234567890",
+      "57edf4a22be3c955ac49da2e2107b67a" },
+};
+
+/* n times 'a': the padding fits the last block up to 55 bytes, from
+ * 56 on it takes another one
+ */
+static const struct {
+    unsigned int len;
+    const char *digest;
+} boundary[] = {
+    { 55, "ef1772b6dff9a122358552954ad0df65" },
+    { 56, "3b0c8ac703f828b04c6c197006d17218" },
+    { 57, "652b906d60af96844ebd21b674f35e93" },
+    { 63, "b06521f39153d618550606be297466d5" },
+    { 64, "014842d480b571495a4a0363793f7367" },
+    { 65, "c743a45e0d2e6a95cb859adae0248435" },
+    { 119, "8a7bd0732ed6a28ce75f6dabc90e1613" },
+    { 120, "5f61c0ccad4cac44c75ff505e1f1e537" },
+    { 128, "e510683b3f5ffe4093d021808bc6ff70" },
+    { 129, "b325dc1c6f5e7a2b7cf465b9feab7948" },
+    { 1000, "cabe45dcc9ae5b66ba86600cca6b8ba8" },
+    { 1000000, "7707d6ae4e027c70eea2a935c2296f21" },
+};
+
+/* pieces handed to MD5Update(), 0 for all at once */
+static const unsigned int chunks[] = { 0, 1, 3, 55, 63, 64, 65, 200 };
+
+static int failed = 0;
+
+static void check(const char *what, unsigned char *msg, unsigned int len,
+    const char *expect) {
+
+    unsigned char digest[MD5_LEN];
+    char hex[2 * MD5_LEN + 1];
+    unsigned int c, off, n;
+    MD5_CTX ctx;
+    int i;
+
+    for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+        MD5Init(&ctx);
+        for (off = 0; off < len; off += n) {
+            n = chunks[c] == 0 || len - off < chunks[c] ? len - off
+                : chunks[c];
+            MD5Update(&ctx, msg + off, n);
+        }
+        MD5Final(digest, &ctx);
+
+        for (i = 0; i < MD5_LEN; i++)
+            sprintf(hex + 2 * i, "%02x", digest[i]);
+        if (strcmp(hex, expect)) {
+            printf("FAIL %s, %u byte pieces: %s, expected %s\n", what,
+                chunks[c], hex, expect);
+            failed++;
+        }
+    }
+}
+
+int main(void) {
+    unsigned char *a;
+    char what[32];
+    unsigned int i;
+
+    for (i = 0; i < sizeof(rfc1321) / sizeof(rfc1321[0]); i++)
+        check(rfc1321[i].msg, (unsigned char *) rfc1321[i].msg,
+            strlen(rfc1321[i].msg), rfc1321[i].digest);
+
+    a = (unsigned char *) malloc(1000000);
+    memset(a, 'a', 1000000);
+    for (i = 0; i < sizeof(boundary) / sizeof(boundary[0]); i++) {
+        sprintf(what, "%u times 'a'", boundary[i].len);
+        check(what, a, boundary[i].len, boundary[i].digest);
+    }
+    free(a);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+/* md5multi_test.c - MD5Multi() and _tac_crypt_batch() against their
+ * one message at a time counterparts.
+ *
+ * Every lane width available here is tried on batches of 1 to 17
+ * messages of mixed lengths, so full and partly filled vectors as well
+ * as the single message left over for the scalar code all come up.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtac.h"
+#include "md5.h"
+
+#define MAX_BATCH 17
+
+/* around one and two blocks, where the padding spills over */
+static const unsigned int lens[] = {
+    0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 200, 1000
+};
+#define NLENS (sizeof(lens) / sizeof(lens[0]))
+
+/* body lengths for the pad, around whole and partial MD5 runs */
+static const int body_lens[] = { 0, 1, 15, 16, 17, 55, 56, 64, 65, 300 };
+#define NBODY (sizeof(body_lens) / sizeof(body_lens[0]))
+
+static const char *keys[] = {
+    "k", "secret", NULL, "a-key-of-more-than-one-md5-block-xxxxxxxxxxxxxxxxxxxx"
+    "xxxxxxxxxxxxxxxxxxx", ""
+};
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+
+static const int lane_widths[] = { 0, 4, 8 };
+
+static int failed = 0;
+
+static void fill(unsigned char *p, unsigned int len, unsigned int seed) {
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+        p[i] = (unsigned char) (seed * 131 + i * 7 + (i >> 8));
+}
+
+static void md5_one(unsigned char *digest, unsigned char *msg,
+    unsigned int len) {
+
+    MD5_CTX ctx;
+
+    MD5Init(&ctx);
+    MD5Update(&ctx, msg, len);
+    MD5Final(digest, &ctx);
+}
+
+/* n messages into separate digests, then again with every digest
+ * overwriting its own message
+ */
+static void check_multi(int lanes, int n) {
+    unsigned char *msg[MAX_BATCH], *digest[MAX_BATCH];
+    unsigned char expect[MAX_BATCH][MD5_LEN];
+    unsigned int len[MAX_BATCH];
+    int k;
+
+    for (k = 0; k < n; k++) {
+        len[k] = lens[(k * 5 + n) % NLENS];
+        /* room for a digest written over a short message */
+        msg[k] = (unsigned char *) calloc(1, len[k] + MD5_LEN);
+        digest[k] = (unsigned char *) calloc(1, MD5_LEN);
+        fill(msg[k], len[k], k + n);
+        md5_one(expect[k], msg[k], len[k]);
+    }
+
+    MD5Multi(n, msg, len, digest);
+    for (k = 0; k < n; k++) {
+        if (memcmp(digest[k], expect[k], MD5_LEN)) {
+            printf("FAIL %d lanes, batch of %d: message %d of %u bytes\n",
+                lanes, n, k, len[k]);
+            failed++;
+        }
+    }
+
+    MD5Multi(n, msg, len, msg);
+    for (k = 0; k < n; k++) {
+        if (memcmp(msg[k], expect[k], MD5_LEN)) {
+            printf("FAIL %d lanes, batch of %d in place: message %d of %u"
+                " bytes\n", lanes, n, k, len[k]);
+            failed++;
+        }
+        free(msg[k]);
+        free(digest[k]);
+    }
+}
+
+/* n bodies through _tac_crypt_batch() and each through _tac_crypt() */
+static void check_batch(int lanes, int n) {
+    struct tac_crypt_job job[MAX_BATCH];
+    HDR th[MAX_BATCH];
+    u_char *one[MAX_BATCH];
+    int k;
+
+    for (k = 0; k < n; k++) {
+        bzero(&th[k], sizeof(HDR));
+        th[k].version = TAC_PLUS_VER_0;
+        th[k].seq_no = 1 + 2 * k;
+        th[k].session_id = htonl(0x10203040 + k * 977);
+        /* every seventh goes unencrypted by flag */
+        th[k].encryption = k % 7 == 6 ? TAC_PLUS_UNENCRYPTED_FLAG
+            : TAC_PLUS_ENCRYPTED_FLAG;
+
+        job[k].len = body_lens[(k * 3 + n) % NBODY];
+        job[k].buf = (u_char *) calloc(1, job[k].len + 1);
+        job[k].th = &th[k];
+        job[k].key = (char *) keys[(k + n) % NKEYS];
+        fill(job[k].buf, job[k].len, k);
+
+        one[k] = (u_char *) calloc(1, job[k].len + 1);
+        fill(one[k], job[k].len, k);
+        tac_secret = job[k].key != NULL && *job[k].key ? job[k].key : NULL;
+        _tac_crypt(one[k], &th[k], job[k].len);
+    }
+    tac_secret = NULL;
+
+    _tac_crypt_batch(job, n);
+    for (k = 0; k < n; k++) {
+        if (memcmp(job[k].buf, one[k], job[k].len)) {
+            printf("FAIL %d lanes, crypt batch of %d: body %d of %d bytes,"
+                " key %s\n", lanes, n, k, job[k].len,
+                job[k].key != NULL ? job[k].key : "NULL");
+            failed++;
+        }
+        free(job[k].buf);
+        free(one[k]);
+    }
+}
+
+int main(void) {
+    unsigned int w;
+    int n;
+
+    /* the built-in provider is the one that goes through MD5Multi() */
+    tac_crypto_select("builtin");
+
+    for (w = 0; w < sizeof(lane_widths) / sizeof(lane_widths[0]); w++) {
+        if (MD5MultiLanes(lane_widths[w]) < 0) {
+            printf("no %d lanes here, skipped\n", lane_widths[w]);
+            continue;
+        }
+        for (n = 1; n <= MAX_BATCH; n++) {
+            check_multi(lane_widths[w], n);
+            check_batch(lane_widths[w], n);
+        }
+    }
+    MD5MultiLanes(-1);
+
+    return failed ? 1 : 0;
+}
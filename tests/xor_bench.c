@@ -0,0 +1,92 @@
+/* xor_bench.c - bytes per cycle of the _tac_xor() variants.
+ *
+ * Run with `make bench'. Each variant XORs a 64 byte, 1 KB and 64 KB
+ * pad into a body many times over and the best round counts. Cycles
+ * are TSC ticks on x86; elsewhere the figure is bytes per nanosecond.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICKS "cycle"
+#else
+#define TICKS "ns"
+#endif
+
+#include "libtac.h"
+
+#define ROUNDS 7
+
+static const int widths[] = { 1, 16, 32, 64 };
+static const int sizes[] = { 64, 1024, 65536 };
+
+static unsigned long long ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int main(void) {
+    u_char *buf = (u_char *) calloc(1, 65536);
+    u_char *pad = (u_char *) calloc(1, 65536);
+    unsigned long long t, best;
+    unsigned int w, s;
+    long reps, r;
+    int round;
+
+    printf("%6s", "width");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        printf(" %8d B", sizes[s]);
+    printf("   (bytes/%s)\n", TICKS);
+
+    for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        if (_tac_xor_select(widths[w]) < 0) {
+            printf("%6d   not available here\n", widths[w]);
+            continue;
+        }
+        printf("%6d", widths[w]);
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            /* about 16 MB a round, the buffers stay in cache */
+            reps = (16L << 20) / sizes[s];
+            best = ~0ULL;
+            for (round = 0; round < ROUNDS; round++) {
+                t = ticks();
+                for (r = 0; r < reps; r++)
+                    _tac_xor(buf, pad, sizes[s]);
+                t = ticks() - t;
+                if (t < best)
+                    best = t;
+            }
+            printf(" %10.2f", (double) reps * sizes[s] / best);
+        }
+        printf("\n");
+    }
+    _tac_xor_select(0);
+
+    free(pad);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/* xor_test.c - every _tac_xor() variant against a plain byte loop.
+ *
+ * buf and pad start at different misalignments and the lengths are
+ * mostly not a multiple of the vector width, so the unaligned moves
+ * and the byte tail are both covered; the bytes around buf must stay
+ * untouched.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program - see the file COPYING.
+ *
+ * See `CHANGES' file for revision history.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libtac.h"
+
+#define GUARD 64
+
+static const int widths[] = { 1, 16, 32, 64 };
+static const int offsets[] = { 0, 1, 3, 7, 15, 16, 31, 33, 63 };
+static const int big_lens[] = { 1000, 1024, 4095, 65536, 65536 + 7 };
+
+static int failed = 0;
+
+static void fill(u_char *p, int len, int seed) {
+    int i;
+
+    for (i = 0; i < len; i++)
+        p[i] = (u_char) (seed + i * 37 + (i >> 8));
+}
+
+static void check(int width, int len, int boff, int poff) {
+    u_char *buf = (u_char *) malloc(len + 2 * GUARD + 64);
+    u_char *pad = (u_char *) malloc(len + 64);
+    u_char *expect = (u_char *) malloc(len + 2 * GUARD + 64);
+    u_char *b = buf + GUARD + boff, *p = pad + poff;
+    int i;
+
+    fill(buf, len + 2 * GUARD + 64, 1);
+    fill(pad, len + 64, 2);
+    memcpy(expect, buf, len + 2 * GUARD + 64);
+    for (i = 0; i < len; i++)
+        expect[GUARD + boff + i] ^= p[i];
+
+    _tac_xor(b, p, len);
+    if (memcmp(buf, expect, len + 2 * GUARD + 64)) {
+        printf("FAIL %d byte xor: %d bytes, buf+%d, pad+%d\n", width, len,
+            boff, poff);
+        failed++;
+    }
+    free(expect);
+    free(pad);
+    free(buf);
+}
+
+int main(void) {
+    unsigned int w, b, p, i;
+    int len;
+
+    for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        if (_tac_xor_select(widths[w]) < 0) {
+            printf("no %d byte xor here, skipped\n", widths[w]);
+            continue;
+        }
+        for (b = 0; b < sizeof(offsets) / sizeof(offsets[0]); b++) {
+            for (p = 0; p < sizeof(offsets) / sizeof(offsets[0]); p++) {
+                for (len = 0; len <= 3 * 64 + 1; len++)
+                    check(widths[w], len, offsets[b], offsets[p]);
+                for (i = 0; i < sizeof(big_lens) / sizeof(big_lens[0]); i++)
+                    check(widths[w], big_lens[i], offsets[b], offsets[p]);
+            }
+        }
+    }
+    _tac_xor_select(0);
+
+    return failed ? 1 : 0;
+}